@@ -0,0 +1,440 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <intrin.h>
+#include <windows.h>
+
+
+// microbenchmark harness; times with QueryPerformanceCounter like PerformanceTimer
+
+
+namespace Util
+{
+
+namespace Benchmark
+{
+
+inline void useAddress(const volatile void* p) noexcept
+{
+    static const volatile void* volatile sink = nullptr;
+    sink = p;
+}
+
+// forces the value to be materialized so the computation can't be dropped
+template <typename _Ty>
+inline void doNotOptimize(_Ty const& value) noexcept
+{
+    useAddress(&value);
+    _ReadWriteBarrier();
+}
+
+// prevents the compiler from caching or eliding memory accesses across this point
+inline void clobberMemory() noexcept
+{
+    _ReadWriteBarrier();
+}
+
+inline double nowNs() noexcept
+{
+    static const double nsPerTick = []()
+    {
+        LARGE_INTEGER f;
+        ::QueryPerformanceFrequency(&f);
+        return 1e9 / double(f.QuadPart);
+    }();
+
+    LARGE_INTEGER t;
+    ::QueryPerformanceCounter(&t);
+    return t.QuadPart * nsPerTick;
+}
+
+
+struct Options
+{
+    double warmupNs = 50e6;        // run the body this long before measuring
+    double minRepetitionNs = 20e6; // pick the iteration count so a repetition lasts at least this
+    size_t repetitions = 9;
+    uint64_t maxIterations = uint64_t(1) << 32;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t iterations = 0;       // per repetition
+    size_t repetitions = 0;
+    double medianNs = 0;           // per iteration
+    double madNs = 0;              // median absolute deviation, per iteration
+    double minNs = 0;
+    double bytesPerSecond = 0;     // 0 unless the benchmark declared bytes per iteration
+};
+
+
+// the body runs the measured operation 'iterations' times
+using Body = std::function<void(uint64_t iterations)>;
+
+
+inline double median(std::vector<double> v)
+{
+    if (v.empty())
+        return 0;
+
+    std::sort(v.begin(), v.end());
+    auto n = v.size();
+    return (n & 1) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+inline double medianAbsoluteDeviation(std::vector<double> const& v, double m)
+{
+    std::vector<double> d;
+    d.reserve(v.size());
+    for (auto x : v)
+        d.push_back(std::fabs(x - m));
+
+    return median(std::move(d));
+}
+
+
+inline Result run(const char* name, Body const& body, uint64_t bytesPerIteration = 0, Options const& o = Options())
+{
+    // at least one sample, and at least one iteration per sample
+    auto repetitions = std::max<size_t>(o.repetitions, 1);
+    auto maxIterations = std::max<uint64_t>(o.maxIterations, 1);
+
+    // untimed, so a Lazy fixture built by the first call doesn't skew the estimate
+    body(1);
+
+    // warmup, which also gives the first cost estimate
+    uint64_t n = 1;
+    double elapsed = 0;
+    double warmupStarted = nowNs();
+    for (;;)
+    {
+        auto started = nowNs();
+        body(n);
+        elapsed = nowNs() - started;
+
+        if ((nowNs() - warmupStarted >= o.warmupNs) && (elapsed >= o.minRepetitionNs / 10))
+            break;
+
+        if (n >= maxIterations)
+            break;
+
+        n *= 2;
+    }
+
+    // scale the iteration count to the target repetition time
+    if (elapsed < o.minRepetitionNs)
+    {
+        auto scale = (elapsed > 0) ? (o.minRepetitionNs / elapsed) * 1.2 : 10.0;
+        auto next = uint64_t(double(n) * scale);
+        n = std::min(std::max(next, n), maxIterations);
+    }
+
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+    for (size_t i = 0; i < repetitions; ++i)
+    {
+        auto started = nowNs();
+        body(n);
+        samples.push_back((nowNs() - started) / double(n));
+    }
+
+    Result r;
+    r.name = name;
+    r.iterations = n;
+    r.repetitions = samples.size();
+    r.medianNs = median(samples);
+    r.madNs = medianAbsoluteDeviation(samples, r.medianNs);
+    r.minNs = *std::min_element(samples.begin(), samples.end());
+    if (bytesPerIteration && r.medianNs > 0)
+        r.bytesPerSecond = bytesPerIteration * 1e9 / r.medianNs;
+
+    return r;
+}
+
+
+// a fixture built by the first benchmark body that touches it, so a filtered run
+// doesn't build, or hold the memory of, fixtures it skips; copies share it
+//
+//   auto table = lazy([] { auto t = std::make_unique<Table>(); fill(*t); return t; });
+//   r.add("Table/find", [table](uint64_t n) { table->find(...); });
+template <typename _Ty>
+class Lazy
+{
+public:
+    explicit Lazy(std::function<std::unique_ptr<_Ty>()> make)
+        : m_state(std::make_shared<State>())
+    {
+        m_state->make = std::move(make);
+    }
+
+    _Ty& operator*() const
+    {
+        auto& s = *m_state;
+        std::call_once(s.once, [&s]()
+        {
+            s.value = s.make();
+            s.make = nullptr;
+        });
+
+        return *s.value;
+    }
+
+    _Ty* operator->() const
+    {
+        return &**this;
+    }
+
+private:
+    struct State
+    {
+        std::once_flag once;
+        std::function<std::unique_ptr<_Ty>()> make;
+        std::unique_ptr<_Ty> value;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+// make() returns a std::unique_ptr to the fixture
+template <typename _Make>
+auto lazy(_Make make) -> Lazy<typename decltype(make())::element_type>
+{
+    return Lazy<typename decltype(make())::element_type>(std::move(make));
+}
+
+
+class Registry
+{
+public:
+    void add(const char* name, Body&& body, uint64_t bytesPerIteration = 0)
+    {
+        m_entries.push_back(Entry{ name, std::move(body), bytesPerIteration });
+    }
+
+    // runs every benchmark whose name contains filter
+    std::vector<Result> run(const char* filter = nullptr, Options const& o = Options(), FILE* progress = stdout) const
+    {
+        std::vector<Result> results;
+        for (auto const& e : m_entries)
+        {
+            if (filter && e.name.find(filter) == std::string::npos)
+                continue;
+
+            results.push_back(Benchmark::run(e.name.c_str(), e.body, e.bytesPerIteration, o));
+
+            if (progress)
+            {
+                auto const& r = results.back();
+                std::fprintf(progress, "%-48s %12.2f ns  +-%8.2f  %12llu it", r.name.c_str(), r.medianNs, r.madNs, (unsigned long long)r.iterations);
+                if (r.bytesPerSecond > 0)
+                    std::fprintf(progress, "  %10.1f MB/s", r.bytesPerSecond / (1024 * 1024));
+
+                std::fprintf(progress, "\n");
+            }
+        }
+
+        return results;
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        Body body;
+        uint64_t bytesPerIteration;
+    };
+
+    std::vector<Entry> m_entries;
+};
+
+
+//
+// JSON persistence; the reader only understands what toJson() writes
+//
+
+inline std::string toJson(std::vector<Result> const& results)
+{
+    std::ostringstream s;
+    s.precision(17);
+    s << "{\n  \"benchmarks\": [";
+
+    bool first = true;
+    for (auto const& r : results)
+    {
+        s << (first ? "\n" : ",\n");
+        first = false;
+
+        s << "    {\"name\": \"";
+        for (auto c : r.name)
+        {
+            if (c == '"' || c == '\\')
+                s << '\\';
+            s << c;
+        }
+
+        s << "\", \"iterations\": " << r.iterations
+          << ", \"repetitions\": " << r.repetitions
+          << ", \"median_ns\": " << r.medianNs
+          << ", \"mad_ns\": " << r.madNs
+          << ", \"min_ns\": " << r.minNs
+          << ", \"bytes_per_second\": " << r.bytesPerSecond
+          << "}";
+    }
+
+    s << "\n  ]\n}\n";
+    return s.str();
+}
+
+namespace Detail
+{
+
+inline bool jsonString(std::string const& obj, const char* key, std::string& value)
+{
+    auto k = std::string("\"") + key + "\"";
+    auto p = obj.find(k);
+    if (p == std::string::npos)
+        return false;
+
+    p = obj.find('"', obj.find(':', p + k.size()));
+    if (p == std::string::npos)
+        return false;
+
+    value.clear();
+    for (++p; p < obj.size() && obj[p] != '"'; ++p)
+    {
+        if (obj[p] == '\\' && p + 1 < obj.size())
+            ++p;
+
+        value.push_back(obj[p]);
+    }
+
+    return true;
+}
+
+inline bool jsonNumber(std::string const& obj, const char* key, double& value)
+{
+    auto k = std::string("\"") + key + "\"";
+    auto p = obj.find(k);
+    if (p == std::string::npos)
+        return false;
+
+    p = obj.find(':', p + k.size());
+    if (p == std::string::npos)
+        return false;
+
+    value = std::strtod(obj.c_str() + p + 1, nullptr);
+    return true;
+}
+
+} // namespace Detail {}
+
+inline std::vector<Result> fromJson(std::string const& json)
+{
+    std::vector<Result> results;
+
+    auto p = json.find('[');
+    while (p != std::string::npos)
+    {
+        auto b = json.find('{', p);
+        if (b == std::string::npos)
+            break;
+
+        auto e = json.find('}', b);
+        if (e == std::string::npos)
+            break;
+
+        auto obj = json.substr(b, e - b + 1);
+        Result r;
+        double v = 0;
+        if (Detail::jsonString(obj, "name", r.name))
+        {
+            if (Detail::jsonNumber(obj, "iterations", v)) r.iterations = uint64_t(v);
+            if (Detail::jsonNumber(obj, "repetitions", v)) r.repetitions = size_t(v);
+            Detail::jsonNumber(obj, "median_ns", r.medianNs);
+            Detail::jsonNumber(obj, "mad_ns", r.madNs);
+            Detail::jsonNumber(obj, "min_ns", r.minNs);
+            Detail::jsonNumber(obj, "bytes_per_second", r.bytesPerSecond);
+            results.push_back(std::move(r));
+        }
+
+        p = e + 1;
+    }
+
+    return results;
+}
+
+inline bool saveJson(const char* path, std::vector<Result> const& results)
+{
+    std::ofstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+
+    f << toJson(results);
+    return !!f;
+}
+
+inline bool loadJson(const char* path, std::vector<Result>& results)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+        return false;
+
+    std::stringstream s;
+    s << f.rdbuf();
+    results = fromJson(s.str());
+    return true;
+}
+
+
+//
+// a regression is a slowdown above the relative threshold that also exceeds
+// the combined noise (3 x MAD) of both runs
+//
+
+struct Comparison
+{
+    std::string name;
+    double baselineNs;
+    double currentNs;
+    double change;       // relative, +0.1 is 10% slower
+    bool regression;
+};
+
+inline std::vector<Comparison> compare(std::vector<Result> const& baseline, std::vector<Result> const& current, double threshold = 0.05)
+{
+    std::vector<Comparison> out;
+    for (auto const& c : current)
+    {
+        auto b = std::find_if(baseline.begin(), baseline.end(), [&c](Result const& r) { return r.name == c.name; });
+        if (b == baseline.end() || b->medianNs <= 0)
+            continue;
+
+        Comparison x;
+        x.name = c.name;
+        x.baselineNs = b->medianNs;
+        x.currentNs = c.medianNs;
+        x.change = (c.medianNs - b->medianNs) / b->medianNs;
+        x.regression = (x.change > threshold) && ((c.medianNs - b->medianNs) > 3 * (c.madNs + b->madNs));
+        out.push_back(std::move(x));
+    }
+
+    return out;
+}
+
+
+} // namespace Benchmark {}
+
+} // namespace Util {}
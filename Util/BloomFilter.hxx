@@ -0,0 +1,405 @@
+#pragma once
+
+#include "./murmurhash.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include <emmintrin.h>
+#include <malloc.h>
+#include <xmmintrin.h>
+
+
+// Bloom filters for skipping lookups of keys that are certainly absent
+//
+// the bits are split into 64 byte blocks; one murmurHash3_128 picks a block and
+// the k bits inside it (Kirsch-Mitzenmacher: bit i = mix(g1 + i * g2)), so a
+// query costs one hash and one cache line whatever k is
+
+
+namespace Util
+{
+
+namespace Detail
+{
+
+const size_t kBloomBlockBytes = 64;
+
+struct BloomFree
+{
+    void operator()(void* p) const noexcept
+    {
+        ::_aligned_free(p);
+    }
+};
+
+// a zeroed, cache line aligned block array
+inline std::unique_ptr<uint8_t[], BloomFree> bloomAllocate(size_t blocks)
+{
+    auto p = static_cast<uint8_t*>(::_aligned_malloc(blocks * kBloomBlockBytes, kBloomBlockBytes));
+    if (!p)
+        throw std::bad_alloc();
+
+    ::memset(p, 0, blocks * kBloomBlockBytes);
+    return std::unique_ptr<uint8_t[], BloomFree>(p);
+}
+
+// false positive rate of a blocked filter: keys spread over the blocks as a
+// Poisson distribution with mean n / blocks, and a query sees only its own
+// block, so the rates of the blocks are averaged by how likely each load is
+inline double bloomBlockedRate(size_t n, size_t blocks, size_t blockBits, unsigned k) noexcept
+{
+    auto mean = double(n) / double(blocks);
+    auto last = size_t(mean + 10.0 * std::sqrt(mean) + 10.0);
+
+    double rate = 0;
+    for (size_t i = 0; i <= last; ++i)
+    {
+        auto load = std::exp(double(i) * std::log(mean) - mean - std::lgamma(double(i) + 1.0));
+        auto unset = std::pow(1.0 - 1.0 / double(blockBits), double(i) * k);
+        rate += load * std::pow(1.0 - unset, double(k));
+    }
+
+    return rate;
+}
+
+// blocks and probes for n keys at false positive rate p; starts from the size of
+// a flat filter, which the uneven load of the blocks makes too small at low p,
+// and grows until the blocked rate is met
+inline void bloomShape(size_t n, double p, size_t blockBits, size_t& blocks, unsigned& k) noexcept
+{
+    const double ln2 = 0.6931471805599453;
+
+    n = std::max<size_t>(n, 1);
+    p = std::min(std::max(p, 1e-9), 0.5);
+
+    auto bits = -double(n) * std::log(p) / (ln2 * ln2);
+    blocks = std::max<size_t>(1, size_t(std::ceil(bits / double(blockBits))));
+    for (;;)
+    {
+        auto best = 1.0;
+        for (unsigned probes = 1; probes <= 16; ++probes)
+        {
+            auto rate = bloomBlockedRate(n, blocks, blockBits, probes);
+            if (rate < best)
+            {
+                best = rate;
+                k = probes;
+            }
+        }
+
+        if (best <= p)
+            break;
+
+        blocks += std::max<size_t>(1, blocks / 32);
+    }
+}
+
+// block index from the high half of h1, without a division
+inline size_t bloomBlock(Hash128 const& h, size_t blocks) noexcept
+{
+    return size_t((uint64_t(uint32_t(h.h1 >> 32)) * blocks) >> 32);
+}
+
+// the i-th probe as the top 'bits' bits of g1 + i * g2, run through the
+// murmur finalizer; the plain sequence is an arithmetic progression in a
+// block of 512 or 128 positions, which repeats and clusters probes enough to
+// miss the target rate several times over at high k
+inline unsigned bloomProbe(Hash128 const& h, unsigned i, unsigned bits) noexcept
+{
+    auto g1 = uint32_t(h.h1);
+    auto g2 = uint32_t(h.h2) | 1;
+    auto x = g1 + i * g2;
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    x ^= x >> 16;
+    return x >> (32 - bits);
+}
+
+} // namespace Detail {}
+
+
+class BloomFilter
+{
+public:
+    // sized for expectedKeys at falsePositiveRate; more keys raise the rate
+    BloomFilter(size_t expectedKeys, double falsePositiveRate, uint32_t seed = 0)
+        : m_seed(seed)
+    {
+        Detail::bloomShape(expectedKeys, falsePositiveRate, kBlockBits, m_blocks, m_k);
+        m_bits = Detail::bloomAllocate(m_blocks);
+    }
+
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    BloomFilter(BloomFilter&&) noexcept = default;
+    BloomFilter& operator=(BloomFilter&&) noexcept = default;
+
+    size_t bitCount() const noexcept
+    {
+        return m_blocks * kBlockBits;
+    }
+
+    unsigned hashCount() const noexcept
+    {
+        return m_k;
+    }
+
+    void clear() noexcept
+    {
+        ::memset(m_bits.get(), 0, m_blocks * Detail::kBloomBlockBytes);
+    }
+
+    // the hash the filter expects; callers that already have it skip rehashing
+    Hash128 hash(const void* key, size_t len) const noexcept
+    {
+        return murmurHash3_128(key, len, m_seed);
+    }
+
+    void insert(Hash128 const& h) noexcept
+    {
+        auto block = blockAt(h);
+        for (unsigned i = 0; i < m_k; ++i)
+        {
+            auto bit = Detail::bloomProbe(h, i, 9);
+            block[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+    }
+
+    void insert(const void* key, size_t len) noexcept
+    {
+        insert(hash(key, len));
+    }
+
+    template <typename _Key>
+    void insert(_Key const& key) noexcept
+    {
+        insert(Detail::murmurKey128(key, m_seed));
+    }
+
+    // false means the key was never inserted
+    bool mayContain(Hash128 const& h) const noexcept
+    {
+        return test(blockAt(h), h);
+    }
+
+    bool mayContain(const void* key, size_t len) const noexcept
+    {
+        return mayContain(hash(key, len));
+    }
+
+    template <typename _Key>
+    bool mayContain(_Key const& key) const noexcept
+    {
+        return mayContain(Detail::murmurKey128(key, m_seed));
+    }
+
+    // out[i] = mayContain(hashes[i]); block loads are prefetched a few keys
+    // ahead so the cache misses of a batch overlap
+    void mayContain(const Hash128* hashes, size_t count, bool* out) const noexcept
+    {
+        const size_t kAhead = 8;
+
+        for (size_t i = 0; i < std::min(count, kAhead); ++i)
+            _mm_prefetch(reinterpret_cast<const char*>(blockAt(hashes[i])), _MM_HINT_T0);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (i + kAhead < count)
+                _mm_prefetch(reinterpret_cast<const char*>(blockAt(hashes[i + kAhead])), _MM_HINT_T0);
+
+            out[i] = test(blockAt(hashes[i]), hashes[i]);
+        }
+    }
+
+    void mayContain(const void* const* keys, const size_t* lens, size_t count, bool* out) const
+    {
+        const size_t kChunk = 64;
+        Hash128 hashes[kChunk];
+
+        for (size_t i = 0; i < count; i += kChunk)
+        {
+            auto n = std::min(kChunk, count - i);
+            for (size_t j = 0; j < n; ++j)
+                hashes[j] = hash(keys[i + j], lens[i + j]);
+
+            mayContain(hashes, n, out + i);
+        }
+    }
+
+private:
+    static const size_t kBlockBits = Detail::kBloomBlockBytes * 8;
+
+    uint64_t* blockAt(Hash128 const& h) const noexcept
+    {
+        return reinterpret_cast<uint64_t*>(m_bits.get()) + Detail::bloomBlock(h, m_blocks) * 8;
+    }
+
+    // builds the probe mask of the key and compares it with the whole block at once
+    bool test(const uint64_t* block, Hash128 const& h) const noexcept
+    {
+        alignas(16) uint64_t mask[8] = {};
+        for (unsigned i = 0; i < m_k; ++i)
+        {
+            auto bit = Detail::bloomProbe(h, i, 9);
+            mask[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+
+        auto missing = _mm_setzero_si128();
+        for (int i = 0; i < 4; ++i)
+        {
+            auto m = _mm_load_si128(reinterpret_cast<const __m128i*>(mask) + i);
+            auto b = _mm_load_si128(reinterpret_cast<const __m128i*>(block) + i);
+            missing = _mm_or_si128(missing, _mm_andnot_si128(b, m));
+        }
+
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xffff;
+    }
+
+    std::unique_ptr<uint8_t[], Detail::BloomFree> m_bits;
+    size_t m_blocks = 0;
+    unsigned m_k = 0;
+    uint32_t m_seed;
+};
+
+
+// the same blocked layout with 4 bit counters (128 per cache line) instead of
+// bits, so keys can be erased; a counter that reaches 15 stays there, erasing
+// never produces false negatives for the other keys but the filter slowly fills
+class CountingBloomFilter
+{
+public:
+    CountingBloomFilter(size_t expectedKeys, double falsePositiveRate, uint32_t seed = 0)
+        : m_seed(seed)
+    {
+        Detail::bloomShape(expectedKeys, falsePositiveRate, kBlockCounters, m_blocks, m_k);
+        m_counters = Detail::bloomAllocate(m_blocks);
+    }
+
+    CountingBloomFilter(const CountingBloomFilter&) = delete;
+    CountingBloomFilter& operator=(const CountingBloomFilter&) = delete;
+
+    CountingBloomFilter(CountingBloomFilter&&) noexcept = default;
+    CountingBloomFilter& operator=(CountingBloomFilter&&) noexcept = default;
+
+    size_t counterCount() const noexcept
+    {
+        return m_blocks * kBlockCounters;
+    }
+
+    unsigned hashCount() const noexcept
+    {
+        return m_k;
+    }
+
+    void clear() noexcept
+    {
+        ::memset(m_counters.get(), 0, m_blocks * Detail::kBloomBlockBytes);
+    }
+
+    Hash128 hash(const void* key, size_t len) const noexcept
+    {
+        return murmurHash3_128(key, len, m_seed);
+    }
+
+    void insert(Hash128 const& h) noexcept
+    {
+        auto block = blockAt(h);
+        for (unsigned i = 0; i < m_k; ++i)
+        {
+            auto c = Detail::bloomProbe(h, i, 7);
+            if (counter(block, c) < kSaturated)
+                block[c / 2] += uint8_t(1 << ((c & 1) * 4));
+        }
+    }
+
+    void insert(const void* key, size_t len) noexcept
+    {
+        insert(hash(key, len));
+    }
+
+    template <typename _Key>
+    void insert(_Key const& key) noexcept
+    {
+        insert(Detail::murmurKey128(key, m_seed));
+    }
+
+    // only for keys that were inserted; erasing anything else corrupts the filter
+    void erase(Hash128 const& h) noexcept
+    {
+        auto block = blockAt(h);
+        for (unsigned i = 0; i < m_k; ++i)
+        {
+            auto c = Detail::bloomProbe(h, i, 7);
+            auto v = counter(block, c);
+            assert(v > 0);
+            if (v > 0 && v < kSaturated)
+                block[c / 2] -= uint8_t(1 << ((c & 1) * 4));
+        }
+    }
+
+    void erase(const void* key, size_t len) noexcept
+    {
+        erase(hash(key, len));
+    }
+
+    template <typename _Key>
+    void erase(_Key const& key) noexcept
+    {
+        erase(Detail::murmurKey128(key, m_seed));
+    }
+
+    bool mayContain(Hash128 const& h) const noexcept
+    {
+        auto block = blockAt(h);
+        for (unsigned i = 0; i < m_k; ++i)
+        {
+            if (!counter(block, Detail::bloomProbe(h, i, 7)))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool mayContain(const void* key, size_t len) const noexcept
+    {
+        return mayContain(hash(key, len));
+    }
+
+    template <typename _Key>
+    bool mayContain(_Key const& key) const noexcept
+    {
+        return mayContain(Detail::murmurKey128(key, m_seed));
+    }
+
+private:
+    static const size_t kBlockCounters = Detail::kBloomBlockBytes * 2;
+    static const unsigned kSaturated = 15;
+
+    uint8_t* blockAt(Hash128 const& h) const noexcept
+    {
+        return m_counters.get() + Detail::bloomBlock(h, m_blocks) * Detail::kBloomBlockBytes;
+    }
+
+    static unsigned counter(const uint8_t* block, unsigned c) noexcept
+    {
+        return (block[c / 2] >> ((c & 1) * 4)) & 0xf;
+    }
+
+    std::unique_ptr<uint8_t[], Detail::BloomFree> m_counters;
+    size_t m_blocks = 0;
+    unsigned m_k = 0;
+    uint32_t m_seed;
+};
+
+
+} // namespace Util {}
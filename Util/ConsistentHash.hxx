@@ -0,0 +1,211 @@
+#pragma once
+
+#include "./murmurhash.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// shard selection that moves as few keys as possible when the shard set changes
+//
+// jump consistent hash (Lamping, Veach) maps a key to one of n numbered shards
+// in O(log n) with no state; growing n to n + 1 moves only 1 / (n + 1) of the keys,
+// but shards can only be added or removed at the end
+//
+// rendezvous (highest random weight) hashing scores every node against the key
+// and takes the best, so any node can come and go and only its own keys move;
+// a lookup is O(nodes) and never allocates, weights skew the share of each node
+
+
+namespace Util
+{
+
+// the shard of a 64 bit key hash in [0, buckets)
+inline uint32_t jumpConsistentHash(uint64_t hash, uint32_t buckets) noexcept
+{
+    assert(buckets > 0);
+
+    int64_t b = -1;
+    int64_t j = 0;
+    while (j < int64_t(buckets))
+    {
+        b = j;
+        hash = hash * 2862933555777941757ull + 1;
+        j = int64_t(double(b + 1) * (double(int64_t(1) << 31) / double((hash >> 33) + 1)));
+    }
+
+    return uint32_t(b);
+}
+
+inline void jumpConsistentHash(const uint64_t* hashes, size_t count, uint32_t buckets, uint32_t* out) noexcept
+{
+    for (size_t i = 0; i < count; ++i)
+        out[i] = jumpConsistentHash(hashes[i], buckets);
+}
+
+// hashes the key first; small or sequential keys are poor input for the bare function
+template <typename _Key>
+uint32_t jumpShard(_Key const& key, uint32_t shards, uint32_t seed = 0) noexcept
+{
+    auto h = Detail::murmurKey128(key, seed);
+    return jumpConsistentHash(h.h1 ^ h.h2, shards);
+}
+
+
+class RendezvousHash
+{
+public:
+    explicit RendezvousHash(uint32_t seed = 0) noexcept
+        : m_seed(seed)
+    {
+    }
+
+    size_t size() const noexcept
+    {
+        return m_nodes.size();
+    }
+
+    bool empty() const noexcept
+    {
+        return m_nodes.empty();
+    }
+
+    // adds the node or changes its weight; a node gets a share of the keys
+    // proportional to its weight
+    void addNode(uint64_t id, double weight = 1.0)
+    {
+        assert(weight > 0);
+
+        Node n = { id, fmix64(id ^ (uint64_t(m_seed) << 32 | 0x5bd1e995)), 1.0 / weight };
+        auto it = std::find_if(m_nodes.begin(), m_nodes.end(), [id](Node const& x) { return x.id == id; });
+        if (it != m_nodes.end())
+            *it = n;
+        else
+            m_nodes.push_back(n);
+
+        m_uniform = std::all_of(m_nodes.begin(), m_nodes.end(), [this](Node const& x) { return x.invWeight == m_nodes.front().invWeight; });
+    }
+
+    bool removeNode(uint64_t id) noexcept
+    {
+        auto it = std::find_if(m_nodes.begin(), m_nodes.end(), [id](Node const& x) { return x.id == id; });
+        if (it == m_nodes.end())
+            return false;
+
+        m_nodes.erase(it);
+        m_uniform = std::all_of(m_nodes.begin(), m_nodes.end(), [this](Node const& x) { return x.invWeight == m_nodes.front().invWeight; });
+        return true;
+    }
+
+    // the id of the node that owns a 64 bit key hash; there must be at least one node
+    uint64_t route(uint64_t hash) const noexcept
+    {
+        assert(!m_nodes.empty());
+
+        size_t best = 0;
+        auto top = score(hash, m_nodes[0]);
+        for (size_t i = 1; i < m_nodes.size(); ++i)
+        {
+            auto s = score(hash, m_nodes[i]);
+            if (s > top)
+            {
+                top = s;
+                best = i;
+            }
+        }
+
+        return m_nodes[best].id;
+    }
+
+    // out[i] = route(hashes[i]); nodes are visited once per block of keys instead
+    // of once per key
+    void route(const uint64_t* hashes, size_t count, uint64_t* out) const noexcept
+    {
+        assert(!m_nodes.empty());
+
+        if (m_uniform)
+            routeBlocks(hashes, count, out, [](uint64_t hash, Node const& node) { return double(fmix64(hash ^ node.seed) >> 11); });
+        else
+            routeBlocks(hashes, count, out, [](uint64_t hash, Node const& node) { return -cost(hash, node); });
+    }
+
+    template <typename _Key>
+    uint64_t routeKey(_Key const& key) const noexcept
+    {
+        auto h = Detail::murmurKey128(key, m_seed);
+        return route(h.h1 ^ h.h2);
+    }
+
+private:
+    struct Node
+    {
+        uint64_t id;
+        uint64_t seed;          // mixes the node into every key hash
+        double invWeight;
+    };
+
+    // -ln(u) / weight for the node's uniform draw u in (0, 1); the lowest cost wins,
+    // which gives each node a share proportional to its weight
+    static double cost(uint64_t hash, Node const& node) noexcept
+    {
+        auto d = fmix64(hash ^ node.seed);
+        auto u = (double(d >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+        return -std::log(u) * node.invWeight;
+    }
+
+    // higher is better; with equal weights the largest draw wins, no logarithm needed
+    double score(uint64_t hash, Node const& node) const noexcept
+    {
+        if (m_uniform)
+            return double(fmix64(hash ^ node.seed) >> 11);
+
+        return -cost(hash, node);
+    }
+
+    // the per-key best is kept with selects rather than branches, which the
+    // compiler can vectorize and which don't mispredict on random hashes
+    template <typename _Score>
+    void routeBlocks(const uint64_t* hashes, size_t count, uint64_t* out, _Score score) const noexcept
+    {
+        const size_t kBlock = 64;
+        double top[kBlock];
+        uint32_t best[kBlock];
+
+        for (size_t first = 0; first < count; first += kBlock)
+        {
+            auto n = std::min(kBlock, count - first);
+            auto h = hashes + first;
+
+            for (size_t k = 0; k < n; ++k)
+            {
+                top[k] = score(h[k], m_nodes[0]);
+                best[k] = 0;
+            }
+
+            for (size_t i = 1; i < m_nodes.size(); ++i)
+            {
+                auto const& node = m_nodes[i];
+                for (size_t k = 0; k < n; ++k)
+                {
+                    auto s = score(h[k], node);
+                    best[k] = (s > top[k]) ? uint32_t(i) : best[k];
+                    top[k] = (s > top[k]) ? s : top[k];
+                }
+            }
+
+            for (size_t k = 0; k < n; ++k)
+                out[first + k] = m_nodes[best[k]].id;
+        }
+    }
+
+    std::vector<Node> m_nodes;
+    uint32_t m_seed;
+    bool m_uniform = true;
+};
+
+
+} // namespace Util {}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "./murmurhash.hxx"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <emmintrin.h>
+
+
+// count-min sketch: frequency estimates in fixed memory, never below the true
+// count and above it by at most epsilon * total() with probability 1 - delta
+//
+// one murmurHash3_128 per key gives the column of every row by double hashing;
+// sketches with the same shape and seed merge by adding the tables
+
+
+namespace Util
+{
+
+class CountMinSketch
+{
+public:
+    // width rounds up to a power of 2
+    CountMinSketch(double epsilon, double delta, uint32_t seed = 0)
+        : m_seed(seed)
+    {
+        epsilon = std::min(std::max(epsilon, 1e-7), 1.0);
+        delta = std::min(std::max(delta, 1e-12), 0.5);
+
+        auto width = size_t(std::ceil(2.718281828459045 / epsilon));
+        m_width = 16;
+        while (m_width < width)
+            m_width *= 2;
+
+        m_depth = std::max(1u, unsigned(std::ceil(std::log(1.0 / delta))));
+        m_table.assign(m_width * m_depth, 0);
+    }
+
+    size_t width() const noexcept
+    {
+        return m_width;
+    }
+
+    unsigned depth() const noexcept
+    {
+        return m_depth;
+    }
+
+    // sum of all counts added
+    uint64_t total() const noexcept
+    {
+        return m_total;
+    }
+
+    size_t memoryUsage() const noexcept
+    {
+        return m_table.size() * sizeof(uint32_t);
+    }
+
+    void clear() noexcept
+    {
+        std::fill(m_table.begin(), m_table.end(), 0);
+        m_total = 0;
+    }
+
+    Hash128 hash(const void* key, size_t len) const noexcept
+    {
+        return murmurHash3_128(key, len, m_seed);
+    }
+
+    template <typename _Key>
+    Hash128 hash(_Key const& key) const noexcept
+    {
+        return Detail::murmurKey128(key, m_seed);
+    }
+
+    // counters saturate instead of wrapping
+    void add(Hash128 const& h, uint32_t count = 1) noexcept
+    {
+        for (unsigned row = 0; row < m_depth; ++row)
+        {
+            auto& c = m_table[cell(h, row)];
+            c = (c > UINT32_MAX - count) ? UINT32_MAX : c + count;
+        }
+
+        m_total += count;
+    }
+
+    void add(const void* key, size_t len, uint32_t count = 1) noexcept
+    {
+        add(hash(key, len), count);
+    }
+
+    // no count here: add(p, len) with a typed pointer would bind to it and hash
+    // the pointer; add several of a key with add(hash(key), count)
+    template <typename _Key>
+    void add(_Key const& key) noexcept
+    {
+        add(hash(key));
+    }
+
+    uint32_t estimate(Hash128 const& h) const noexcept
+    {
+        uint32_t e = UINT32_MAX;
+        for (unsigned row = 0; row < m_depth; ++row)
+            e = std::min(e, m_table[cell(h, row)]);
+
+        return e;
+    }
+
+    uint32_t estimate(const void* key, size_t len) const noexcept
+    {
+        return estimate(hash(key, len));
+    }
+
+    template <typename _Key>
+    uint32_t estimate(_Key const& key) const noexcept
+    {
+        return estimate(hash(key));
+    }
+
+    // a key is a heavy hitter when its estimate reaches this share of the stream
+    bool isHeavy(Hash128 const& h, double share) const noexcept
+    {
+        return double(estimate(h)) >= share * double(m_total);
+    }
+
+    template <typename _Key>
+    bool isHeavy(_Key const& key, double share) const noexcept
+    {
+        return isHeavy(hash(key), share);
+    }
+
+    // adds o's counts; false unless both have the same shape and seed
+    bool merge(CountMinSketch const& o) noexcept
+    {
+        if (o.m_width != m_width || o.m_depth != m_depth || o.m_seed != m_seed)
+            return false;
+
+        // saturating 32 bit add, 4 counters at a time; the width is a multiple of 16
+        auto a = m_table.data();
+        auto b = o.m_table.data();
+        const auto bias = _mm_set1_epi32(int(0x80000000));
+        for (size_t i = 0; i < m_table.size(); i += 4)
+        {
+            auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            auto sum = _mm_add_epi32(x, y);
+
+            // unsigned overflow iff sum < x; SSE2 only compares signed, hence the bias
+            auto overflow = _mm_cmplt_epi32(_mm_xor_si128(sum, bias), _mm_xor_si128(x, bias));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), _mm_or_si128(sum, overflow));
+        }
+
+        m_total += o.m_total;
+        return true;
+    }
+
+private:
+    size_t cell(Hash128 const& h, unsigned row) const noexcept
+    {
+        return size_t(row) * m_width + size_t((h.h1 + row * (h.h2 | 1)) & (m_width - 1));
+    }
+
+    std::vector<uint32_t> m_table;      // m_depth rows of m_width counters
+    size_t m_width;
+    unsigned m_depth;
+    uint64_t m_total = 0;
+    uint32_t m_seed;
+};
+
+
+} // namespace Util {}
@@ -0,0 +1,666 @@
+#pragma once
+
+#include "./murmurhash.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <emmintrin.h>
+#include <intrin.h>
+
+
+// open addressing hash map in the SwissTable layout: entries live in one array
+// and a parallel array of control bytes holds 7 bits of each entry's hash, so a
+// lookup compares 16 candidates with a few SSE2 instructions and touches the
+// entries only on a probable match
+//
+// unlike std::unordered_map, entries move on rehash, so any insertion may
+// invalidate pointers, references and iterators
+
+
+namespace Util
+{
+
+namespace Detail
+{
+
+// control bytes: full slots hold the low 7 hash bits, everything else is negative
+const int8_t kCtrlEmpty = -128;
+const int8_t kCtrlDeleted = -2;
+const int8_t kCtrlSentinel = -1;    // one past the last slot, stops iteration
+
+const size_t kCtrlGroupWidth = 16;
+
+class ControlGroup
+{
+public:
+    explicit ControlGroup(const int8_t* ctrl) noexcept
+        : m_ctrl(_mm_load_si128(reinterpret_cast<const __m128i*>(ctrl)))
+    {
+    }
+
+    // bit i is set when slot i holds h2
+    uint32_t match(int8_t h2) const noexcept
+    {
+        return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(m_ctrl, _mm_set1_epi8(h2))));
+    }
+
+    uint32_t matchEmpty() const noexcept
+    {
+        return match(kCtrlEmpty);
+    }
+
+    // empty or deleted
+    uint32_t matchFree() const noexcept
+    {
+        return uint32_t(_mm_movemask_epi8(_mm_cmplt_epi8(m_ctrl, _mm_set1_epi8(kCtrlSentinel))));
+    }
+
+    static size_t lowest(uint32_t mask) noexcept
+    {
+        unsigned long i;
+        _BitScanForward(&i, mask);
+        return i;
+    }
+
+private:
+    __m128i m_ctrl;
+};
+
+} // namespace Detail {}
+
+
+template <typename _Key, typename _Value, typename _Hash = MurmurHash<_Key>, typename _Eq = std::equal_to<>>
+class FlatHashMap
+{
+public:
+    using key_type = _Key;
+    using mapped_type = _Value;
+    using value_type = std::pair<const _Key, _Value>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using hasher = _Hash;
+    using key_equal = _Eq;
+    using pointer = value_type *;
+    using const_pointer = value_type const *;
+    using reference = value_type &;
+    using const_reference = value_type const &;
+
+    template <typename _Ref, typename _Ptr>
+    struct basic_iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename FlatHashMap::value_type;
+        using difference_type = typename FlatHashMap::difference_type;
+        using pointer = _Ptr;
+        using reference = _Ref;
+
+        basic_iterator() noexcept = default;
+
+        basic_iterator(const int8_t* ctrl, value_type* slot) noexcept
+            : ctrl(ctrl)
+            , slot(slot)
+        {}
+
+        // iterator -> const_iterator
+        template <typename _OtherRef, typename _OtherPtr, typename = typename std::enable_if<std::is_convertible<_OtherPtr, _Ptr>::value>::type>
+        basic_iterator(basic_iterator<_OtherRef, _OtherPtr> const& o) noexcept
+            : ctrl(o.ctrl)
+            , slot(o.slot)
+        {}
+
+        reference operator*() const noexcept
+        {
+            return *slot;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return slot;
+        }
+
+        basic_iterator& operator++() noexcept
+        {
+            ++ctrl;
+            ++slot;
+            skipFree();
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto Tmp = *this;
+            ++*this;
+            return Tmp;
+        }
+
+        template <typename _OtherRef, typename _OtherPtr>
+        bool operator==(basic_iterator<_OtherRef, _OtherPtr> const& o) const noexcept
+        {
+            return (ctrl == o.ctrl);
+        }
+
+        template <typename _OtherRef, typename _OtherPtr>
+        bool operator!=(basic_iterator<_OtherRef, _OtherPtr> const& o) const noexcept
+        {
+            return (ctrl != o.ctrl);
+        }
+
+        void skipFree() noexcept
+        {
+            while (*ctrl < Detail::kCtrlSentinel)
+            {
+                ++ctrl;
+                ++slot;
+            }
+        }
+
+        const int8_t* ctrl = nullptr;
+        value_type* slot = nullptr;
+    };
+
+    using iterator = basic_iterator<reference, pointer>;
+    using const_iterator = basic_iterator<const_reference, const_pointer>;
+
+    ~FlatHashMap() noexcept
+    {
+        destroy();
+    }
+
+    FlatHashMap() = default;
+
+    explicit FlatHashMap(size_t count, _Hash const& hash = _Hash(), _Eq const& eq = _Eq())
+        : hash_(hash)
+        , eq_(eq)
+    {
+        reserve(count);
+    }
+
+    FlatHashMap(std::initializer_list<value_type> values)
+    {
+        reserve(values.size());
+        for (auto const& v : values)
+            insert(v);
+    }
+
+    FlatHashMap(const FlatHashMap& o)
+        : hash_(o.hash_)
+        , eq_(o.eq_)
+    {
+        reserve(o.size());
+        for (auto const& v : o)
+            insert(v);
+    }
+
+    FlatHashMap& operator=(const FlatHashMap& o)
+    {
+        if (this != &o)
+            FlatHashMap(o).swap(*this);
+
+        return *this;
+    }
+
+    void swap(FlatHashMap& o) noexcept
+    {
+        using std::swap;
+        swap(ctrl_, o.ctrl_);
+        swap(slots_, o.slots_);
+        swap(capacity_, o.capacity_);
+        swap(size_, o.size_);
+        swap(growthLeft_, o.growthLeft_);
+        swap(hash_, o.hash_);
+        swap(eq_, o.eq_);
+    }
+
+    FlatHashMap(FlatHashMap&& o) noexcept
+        : FlatHashMap()
+    {
+        o.swap(*this);
+    }
+
+    FlatHashMap& operator=(FlatHashMap&& o) noexcept
+    {
+        if (this != &o)
+            FlatHashMap(std::move(o)).swap(*this);
+
+        return *this;
+    }
+
+    bool empty() const noexcept
+    {
+        return (size_ == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // number of slots; at most 7/8 of them are ever in use
+    size_t capacity() const noexcept
+    {
+        return capacity_;
+    }
+
+    const_iterator begin() const noexcept
+    {
+        if (!size_)
+            return end();
+
+        const_iterator i(ctrl_, slots_);
+        i.skipFree();
+        return i;
+    }
+
+    iterator begin() noexcept
+    {
+        if (!size_)
+            return end();
+
+        iterator i(ctrl_, slots_);
+        i.skipFree();
+        return i;
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(ctrl_ + capacity_, slots_ + capacity_);
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(ctrl_ + capacity_, slots_ + capacity_);
+    }
+
+    iterator find(_Key const& key) noexcept
+    {
+        return iteratorAt(findIndex(key));
+    }
+
+    const_iterator find(_Key const& key) const noexcept
+    {
+        return iteratorAt(findIndex(key));
+    }
+
+    // heterogeneous lookup, e.g. a const char* in a map keyed by std::string
+    template <typename _K, typename _H = _Hash, typename = typename _H::is_transparent, typename _E = _Eq, typename = typename _E::is_transparent>
+    iterator find(_K const& key) noexcept
+    {
+        return iteratorAt(findIndex(key));
+    }
+
+    template <typename _K, typename _H = _Hash, typename = typename _H::is_transparent, typename _E = _Eq, typename = typename _E::is_transparent>
+    const_iterator find(_K const& key) const noexcept
+    {
+        return iteratorAt(findIndex(key));
+    }
+
+    bool contains(_Key const& key) const noexcept
+    {
+        return (findIndex(key) != npos);
+    }
+
+    template <typename _K, typename _H = _Hash, typename = typename _H::is_transparent, typename _E = _Eq, typename = typename _E::is_transparent>
+    bool contains(_K const& key) const noexcept
+    {
+        return (findIndex(key) != npos);
+    }
+
+    size_t count(_Key const& key) const noexcept
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    _Value& at(_Key const& key)
+    {
+        auto i = findIndex(key);
+        if (i == npos)
+            throw std::exception("Calling at() with a missing key");
+        return slots_[i].second;
+    }
+
+    _Value const& at(_Key const& key) const
+    {
+        auto i = findIndex(key);
+        if (i == npos)
+            throw std::exception("Calling at() with a missing key");
+        return slots_[i].second;
+    }
+
+    _Value& operator[](_Key const& key)
+    {
+        return try_emplace(key).first->second;
+    }
+
+    _Value& operator[](_Key&& key)
+    {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    // constructs the value from args only when the key is not present yet
+    template <typename _K, typename... _Args>
+    std::pair<iterator, bool> try_emplace(_K&& key, _Args&&... args)
+    {
+        auto hash = hash_(key);
+        auto i = findIndex(key, hash);
+        if (i != npos)
+            return std::make_pair(iteratorAt(i), false);
+
+        i = prepareInsert(hash);
+        new (slots_ + i) value_type(
+            std::piecewise_construct,
+            std::forward_as_tuple(std::forward<_K>(key)),
+            std::forward_as_tuple(std::forward<_Args>(args)...)
+            );
+
+        commitInsert(i, hash);
+        return std::make_pair(iteratorAt(i), true);
+    }
+
+    std::pair<iterator, bool> insert(value_type const& value)
+    {
+        return try_emplace(value.first, value.second);
+    }
+
+    template <typename _Pair>
+    std::pair<iterator, bool> insert(_Pair&& value)
+    {
+        return try_emplace(std::forward<_Pair>(value).first, std::forward<_Pair>(value).second);
+    }
+
+    template <typename _K, typename _V>
+    std::pair<iterator, bool> insert_or_assign(_K&& key, _V&& value)
+    {
+        auto r = try_emplace(std::forward<_K>(key), std::forward<_V>(value));
+        if (!r.second)
+            r.first->second = std::forward<_V>(value);
+
+        return r;
+    }
+
+    // returns the iterator following the erased entry
+    iterator erase(const_iterator pos) noexcept
+    {
+        auto i = size_t(pos.slot - slots_);
+        eraseAt(i);
+
+        iterator next(ctrl_ + i, slots_ + i);
+        next.skipFree();
+        return next;
+    }
+
+    // without it the transparent erase(key) template is the better match for a
+    // mutable iterator
+    iterator erase(iterator pos) noexcept
+    {
+        return erase(const_iterator(pos));
+    }
+
+    size_t erase(_Key const& key) noexcept
+    {
+        auto i = findIndex(key);
+        if (i == npos)
+            return 0;
+
+        eraseAt(i);
+        return 1;
+    }
+
+    template <typename _K, typename _H = _Hash, typename = typename _H::is_transparent, typename _E = _Eq, typename = typename _E::is_transparent>
+    size_t erase(_K const& key) noexcept
+    {
+        auto i = findIndex(key);
+        if (i == npos)
+            return 0;
+
+        eraseAt(i);
+        return 1;
+    }
+
+    // keeps the slot array
+    void clear() noexcept
+    {
+        if (!capacity_)
+            return;
+
+        destroyValues();
+        ::memset(ctrl_, Detail::kCtrlEmpty, capacity_);
+        size_ = 0;
+        growthLeft_ = maxLoad(capacity_);
+    }
+
+    // makes room for count entries without rehashing
+    void reserve(size_t count)
+    {
+        size_t capacity = Detail::kCtrlGroupWidth;
+        while (maxLoad(capacity) < count)
+            capacity *= 2;
+
+        if (capacity > capacity_)
+            resize(capacity);
+    }
+
+private:
+    static const size_t npos = size_t(-1);
+
+    static size_t maxLoad(size_t capacity) noexcept
+    {
+        return capacity - capacity / 8;
+    }
+
+    // the low 7 bits go to the control byte, the rest select the group
+    static int8_t h2(size_t hash) noexcept
+    {
+        return int8_t(hash & 0x7f);
+    }
+
+    size_t firstGroup(size_t hash) const noexcept
+    {
+        return (hash >> 7) & (capacity_ / Detail::kCtrlGroupWidth - 1);
+    }
+
+    iterator iteratorAt(size_t i) noexcept
+    {
+        return (i == npos) ? end() : iterator(ctrl_ + i, slots_ + i);
+    }
+
+    const_iterator iteratorAt(size_t i) const noexcept
+    {
+        return (i == npos) ? end() : const_iterator(ctrl_ + i, slots_ + i);
+    }
+
+    template <typename _K>
+    size_t findIndex(_K const& key) const noexcept
+    {
+        if (!size_)
+            return npos;
+
+        return findIndex(key, hash_(key));
+    }
+
+    // triangular probing over groups visits every group of a power of 2 table;
+    // the first group with an empty slot ends the search
+    template <typename _K>
+    size_t findIndex(_K const& key, size_t hash) const noexcept
+    {
+        if (!capacity_)
+            return npos;
+
+        auto mask = capacity_ / Detail::kCtrlGroupWidth - 1;
+        auto g = firstGroup(hash);
+        for (size_t step = 1; ; ++step)
+        {
+            Detail::ControlGroup group(ctrl_ + g * Detail::kCtrlGroupWidth);
+            for (auto m = group.match(h2(hash)); m; m &= m - 1)
+            {
+                auto i = g * Detail::kCtrlGroupWidth + Detail::ControlGroup::lowest(m);
+                if (eq_(slots_[i].first, key))
+                    return i;
+            }
+
+            if (group.matchEmpty())
+                return npos;
+
+            g = (g + step) & mask;
+        }
+    }
+
+    size_t findFree(size_t hash) const noexcept
+    {
+        auto mask = capacity_ / Detail::kCtrlGroupWidth - 1;
+        auto g = firstGroup(hash);
+        for (size_t step = 1; ; ++step)
+        {
+            auto m = Detail::ControlGroup(ctrl_ + g * Detail::kCtrlGroupWidth).matchFree();
+            if (m)
+                return g * Detail::kCtrlGroupWidth + Detail::ControlGroup::lowest(m);
+
+            g = (g + step) & mask;
+        }
+    }
+
+    // a free slot for a new entry; grows the table when no empty slot may be used up
+    size_t prepareInsert(size_t hash)
+    {
+        if (capacity_)
+        {
+            auto i = findFree(hash);
+            if (growthLeft_ || ctrl_[i] == Detail::kCtrlDeleted)
+                return i;
+        }
+
+        // mostly tombstones: rehash in place, otherwise double
+        if (capacity_ && size_ * 2 < maxLoad(capacity_))
+            resize(capacity_);
+        else
+            resize(capacity_ ? capacity_ * 2 : Detail::kCtrlGroupWidth);
+
+        return findFree(hash);
+    }
+
+    void commitInsert(size_t i, size_t hash) noexcept
+    {
+        if (ctrl_[i] == Detail::kCtrlEmpty)
+            --growthLeft_;
+
+        ctrl_[i] = h2(hash);
+        ++size_;
+    }
+
+    void eraseAt(size_t i) noexcept
+    {
+        assert(ctrl_[i] >= 0);
+
+        slots_[i].~value_type();
+        --size_;
+
+        // a group that still has an empty slot never let a probe pass through it,
+        // so the slot can become empty again; otherwise probes must keep going
+        auto g = i & ~(Detail::kCtrlGroupWidth - 1);
+        if (Detail::ControlGroup(ctrl_ + g).matchEmpty())
+        {
+            ctrl_[i] = Detail::kCtrlEmpty;
+            ++growthLeft_;
+        }
+        else
+        {
+            ctrl_[i] = Detail::kCtrlDeleted;
+        }
+    }
+
+    void resize(size_t capacity)
+    {
+        // a relocation that throws halfway would leave entries in both arrays
+        static_assert(std::is_nothrow_move_constructible<_Key>::value && std::is_nothrow_move_constructible<_Value>::value,
+            "FlatHashMap relocates entries when it grows; keys and values must be nothrow movable");
+
+        assert(capacity >= size_);
+
+        // one extra group carries the iteration sentinel; __m128i keeps the groups aligned
+        auto groups = capacity / Detail::kCtrlGroupWidth;
+        std::unique_ptr<__m128i[]> ctrl(new __m128i[groups + 1]);
+        auto slots = std::allocator<value_type>().allocate(capacity);
+
+        auto oldCtrl = ctrl_;
+        auto oldSlots = slots_;
+        auto oldCapacity = capacity_;
+
+        ctrl_ = reinterpret_cast<int8_t*>(ctrl.release());
+        slots_ = slots;
+        capacity_ = capacity;
+        growthLeft_ = maxLoad(capacity) - size_;
+
+        ::memset(ctrl_, Detail::kCtrlEmpty, capacity);
+        ::memset(ctrl_ + capacity, Detail::kCtrlSentinel, Detail::kCtrlGroupWidth);
+
+        // entries are relocated: moved out of the old slot, which is destroyed right away;
+        // the key is const only towards users
+        for (size_t i = 0; i < oldCapacity; ++i)
+        {
+            if (oldCtrl[i] < 0)
+                continue;
+
+            auto& from = oldSlots[i];
+            auto hash = hash_(from.first);
+            auto to = findFree(hash);
+            new (slots_ + to) value_type(std::move(const_cast<_Key&>(from.first)), std::move(from.second));
+            from.~value_type();
+
+            ctrl_[to] = h2(hash);
+        }
+
+        if (oldCtrl)
+        {
+            delete[] reinterpret_cast<__m128i*>(oldCtrl);
+            std::allocator<value_type>().deallocate(oldSlots, oldCapacity);
+        }
+    }
+
+    void destroyValues() noexcept
+    {
+        for (size_t i = 0; i < capacity_; ++i)
+        {
+            if (ctrl_[i] >= 0)
+                slots_[i].~value_type();
+        }
+    }
+
+    void destroy() noexcept
+    {
+        if (!ctrl_)
+            return;
+
+        destroyValues();
+        delete[] reinterpret_cast<__m128i*>(ctrl_);
+        std::allocator<value_type>().deallocate(slots_, capacity_);
+
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = 0;
+        size_ = 0;
+        growthLeft_ = 0;
+    }
+
+protected:
+    int8_t* ctrl_ = nullptr;
+    value_type* slots_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    size_t growthLeft_ = 0;     // empty slots that may still be filled before a rehash
+    _Hash hash_;
+    _Eq eq_;
+};
+
+
+} // namespace Util {}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "./murmurhash.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include <emmintrin.h>
+#include <intrin.h>
+
+
+// HyperLogLog distinct counter over 64 bit murmur hashes; 2^precision registers,
+// standard error about 1.04 / sqrt(2^precision), i.e. 0.8% at the default 14
+//
+// small counters start sparse, as a sorted list of the registers that are set,
+// and switch to one byte per register once that is no longer smaller; both
+// forms give the same estimate and sketches of the same precision merge
+
+
+namespace Util
+{
+
+namespace Detail
+{
+
+// leading zero bits of w != 0; two 32 bit scans so x86 builds work too
+inline unsigned hllLeadingZeros(uint64_t w) noexcept
+{
+    unsigned long i;
+    if (_BitScanReverse(&i, static_cast<unsigned long>(w >> 32)))
+        return 31 - unsigned(i);
+
+    _BitScanReverse(&i, static_cast<unsigned long>(w));
+    return 63 - unsigned(i);
+}
+
+} // namespace Detail {}
+
+
+class HyperLogLog
+{
+public:
+    static const unsigned kMinPrecision = 4;
+    static const unsigned kMaxPrecision = 18;
+
+    explicit HyperLogLog(unsigned precision = 14, uint32_t seed = 0) noexcept
+        : m_precision(precision < kMinPrecision ? kMinPrecision : (precision > kMaxPrecision ? kMaxPrecision : precision))
+        , m_seed(seed)
+    {
+    }
+
+    unsigned precision() const noexcept
+    {
+        return m_precision;
+    }
+
+    bool sparse() const noexcept
+    {
+        return m_dense.empty();
+    }
+
+    // bytes held by the registers
+    size_t memoryUsage() const noexcept
+    {
+        return m_dense.capacity() + (m_sparse.capacity() + m_pending.capacity()) * sizeof(uint32_t);
+    }
+
+    void clear() noexcept
+    {
+        m_dense.clear();
+        m_dense.shrink_to_fit();
+        m_sparse.clear();
+        m_pending.clear();
+    }
+
+    // a 64 bit hash the caller already has; the top 'precision' bits pick the
+    // register, the position of the first 1 in the rest gives the rank
+    void addHash(uint64_t hash)
+    {
+        auto index = uint32_t(hash >> (64 - m_precision));
+        auto rest = (hash << m_precision) | (uint64_t(1) << (m_precision - 1));
+        auto rank = uint8_t(Detail::hllLeadingZeros(rest) + 1);
+
+        if (!sparse())
+        {
+            m_dense[index] = std::max(m_dense[index], rank);
+            return;
+        }
+
+        m_pending.push_back((index << 8) | rank);
+        if (m_pending.size() >= kPendingLimit)
+            flush();
+    }
+
+    void add(const void* key, size_t len)
+    {
+        addHash(murmurHash3_64(key, len, m_seed));
+    }
+
+    template <typename _Key>
+    void add(_Key const& key)
+    {
+        auto h = Detail::murmurKey128(key, m_seed);
+        addHash(h.h1 ^ h.h2);
+    }
+
+    // pending additions are folded into a copy, so readers sharing a sketch don't race
+    double estimate() const
+    {
+        if (!m_pending.empty())
+        {
+            auto folded = *this;
+            folded.flush();
+            return folded.estimate();
+        }
+
+        const size_t m = size_t(1) << m_precision;
+        double sum = 0;
+        size_t zeros = 0;
+
+        if (sparse())
+        {
+            // unset registers each add 2^0
+            zeros = m - m_sparse.size();
+            sum = double(zeros);
+            for (auto e : m_sparse)
+                sum += 1.0 / double(uint64_t(1) << (e & 0xff));
+        }
+        else
+        {
+            for (auto r : m_dense)
+            {
+                sum += 1.0 / double(uint64_t(1) << r);
+                zeros += !r;
+            }
+        }
+
+        double alpha;
+        switch (m)
+        {
+        case 16: alpha = 0.673; break;
+        case 32: alpha = 0.697; break;
+        case 64: alpha = 0.709; break;
+        default: alpha = 0.7213 / (1.0 + 1.079 / double(m)); break;
+        }
+
+        auto raw = alpha * double(m) * double(m) / sum;
+
+        // small range: linear counting is more accurate while registers are still empty
+        if (raw <= 2.5 * double(m) && zeros)
+            return double(m) * std::log(double(m) / double(zeros));
+
+        return raw;
+    }
+
+    // register-wise max; false if the precisions differ
+    bool merge(HyperLogLog const& o)
+    {
+        if (o.m_precision != m_precision)
+            return false;
+
+        if (!o.m_pending.empty())
+        {
+            auto folded = o;
+            folded.flush();
+            return merge(folded);
+        }
+
+        flush();
+
+        if (sparse() && o.sparse())
+        {
+            m_pending = o.m_sparse;
+            flush();
+            return true;
+        }
+
+        densify();
+
+        if (o.sparse())
+        {
+            for (auto e : o.m_sparse)
+                m_dense[e >> 8] = std::max(m_dense[e >> 8], uint8_t(e & 0xff));
+        }
+        else
+        {
+            // at least 16 registers, 16 at a time
+            auto a = m_dense.data();
+            auto b = o.m_dense.data();
+            for (size_t i = 0; i < m_dense.size(); i += 16)
+            {
+                auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), _mm_max_epu8(x, y));
+            }
+        }
+
+        return true;
+    }
+
+private:
+    static const size_t kPendingLimit = 256;
+
+    // folds pending entries into the sorted list, keeping the highest rank per
+    // register, and switches to dense once the list outgrows the register array
+    void flush()
+    {
+        if (m_pending.empty())
+            return;
+
+        std::sort(m_pending.begin(), m_pending.end());
+
+        std::vector<uint32_t> merged;
+        merged.reserve(m_sparse.size() + m_pending.size());
+        std::merge(m_sparse.begin(), m_sparse.end(), m_pending.begin(), m_pending.end(), std::back_inserter(merged));
+        m_pending.clear();
+
+        // sorted by register then rank, so the last entry of a run is the one to keep
+        size_t out = 0;
+        for (size_t i = 0; i < merged.size(); ++i)
+        {
+            if (i + 1 < merged.size() && (merged[i] >> 8) == (merged[i + 1] >> 8))
+                continue;
+
+            merged[out++] = merged[i];
+        }
+
+        merged.resize(out);
+        m_sparse.swap(merged);
+
+        if (m_sparse.size() * sizeof(uint32_t) >= (size_t(1) << m_precision))
+            densify();
+    }
+
+    void densify()
+    {
+        if (!sparse())
+            return;
+
+        m_dense.assign(size_t(1) << m_precision, 0);
+        for (auto e : m_sparse)
+            m_dense[e >> 8] = uint8_t(e & 0xff);
+
+        m_sparse.clear();
+        m_sparse.shrink_to_fit();
+        m_pending.shrink_to_fit();
+    }
+
+    std::vector<uint8_t> m_dense;       // one rank per register, empty while sparse
+    std::vector<uint32_t> m_sparse;     // register << 8 | rank, sorted, one per register
+    std::vector<uint32_t> m_pending;    // unsorted additions to m_sparse
+    unsigned m_precision;
+    uint32_t m_seed;
+};
+
+
+} // namespace Util {}
@@ -0,0 +1,468 @@
+#pragma once
+
+#include "./IntrusiveList.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+
+// a circular doubly linked list closed by a sentinel hook inside the list
+// object: every element always has both neighbours, so linking and unlinking
+// never branch and an element can leave its list knowing nothing but its hook
+//
+// there is no element count, which is what makes hook-only unlink() and O(1)
+// range splice possible; size() walks the list
+
+
+namespace Util
+{
+
+struct IntrusiveCircularHook
+{
+    IntrusiveCircularHook() = default;
+
+    // copies start unlinked, see IntrusiveListHook
+    IntrusiveCircularHook(const IntrusiveCircularHook&) noexcept
+    {
+    }
+
+    IntrusiveCircularHook& operator=(const IntrusiveCircularHook&) noexcept
+    {
+        return *this;
+    }
+
+    bool linked() const noexcept
+    {
+        return next != nullptr;
+    }
+
+    // takes the element out of whatever list holds it
+    void unlink() noexcept
+    {
+        assert(linked());
+
+        prev->next = next;
+        next->prev = prev;
+        prev = nullptr;
+        next = nullptr;
+    }
+
+    IntrusiveCircularHook* prev = nullptr;
+    IntrusiveCircularHook* next = nullptr;
+};
+
+template <typename _Ty>
+using IntrusiveCircularBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, IntrusiveCircularHook>;
+
+template <typename _Ty, IntrusiveCircularHook _Ty::* _Member>
+using IntrusiveCircularMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, IntrusiveCircularHook, _Member>;
+
+
+template <typename _Ty, typename _Hook = IntrusiveCircularBaseHook<_Ty>, typename _Disposer = IntrusiveDelete>
+class IntrusiveCircularList
+{
+public:
+    using value_type = _Ty;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = _Ty *;
+    using const_pointer = _Ty const *;
+    using reference = _Ty &;
+    using const_reference = _Ty const &;
+
+    using Hook = IntrusiveCircularHook;
+
+    template <typename _Ref, typename _Ptr>
+    class basic_iterator
+    {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = typename IntrusiveCircularList::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = _Ptr;
+        using reference = _Ref;
+
+        basic_iterator() noexcept = default;
+
+        explicit basic_iterator(Hook* h) noexcept
+            : h_(h)
+        {
+        }
+
+        // iterator -> const_iterator
+        template <typename _R, typename _P, typename = typename std::enable_if<std::is_convertible<_P, _Ptr>::value>::type>
+        basic_iterator(basic_iterator<_R, _P> const& o) noexcept
+            : h_(o.h_)
+        {
+        }
+
+        reference operator*() const noexcept
+        {
+            return _Hook::element(*h_);
+        }
+
+        pointer operator->() const noexcept
+        {
+            return &_Hook::element(*h_);
+        }
+
+        basic_iterator& operator++() noexcept
+        {
+            h_ = h_->next;
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            h_ = h_->next;
+            return tmp;
+        }
+
+        basic_iterator& operator--() noexcept
+        {
+            h_ = h_->prev;
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto tmp = *this;
+            h_ = h_->prev;
+            return tmp;
+        }
+
+        template <typename _R, typename _P>
+        bool operator==(basic_iterator<_R, _P> const& o) const noexcept
+        {
+            return h_ == o.h_;
+        }
+
+        template <typename _R, typename _P>
+        bool operator!=(basic_iterator<_R, _P> const& o) const noexcept
+        {
+            return h_ != o.h_;
+        }
+
+    private:
+        template <typename, typename> friend class basic_iterator;
+        friend class IntrusiveCircularList;
+
+        Hook* h_ = nullptr;
+    };
+
+    using iterator = basic_iterator<_Ty&, _Ty*>;
+    using const_iterator = basic_iterator<_Ty const&, _Ty const*>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    ~IntrusiveCircularList() noexcept
+    {
+        clear();
+    }
+
+    IntrusiveCircularList() noexcept
+    {
+        head_.prev = &head_;
+        head_.next = &head_;
+    }
+
+    explicit IntrusiveCircularList(_Disposer disposer)
+        : disposer_(std::move(disposer))
+    {
+        head_.prev = &head_;
+        head_.next = &head_;
+    }
+
+    IntrusiveCircularList(const IntrusiveCircularList&) = delete;
+    IntrusiveCircularList& operator=(const IntrusiveCircularList&) = delete;
+
+    void swap(IntrusiveCircularList& o) noexcept
+    {
+        Hook tmp;
+        moveHead(head_, tmp);
+        moveHead(o.head_, head_);
+        moveHead(tmp, o.head_);
+
+        Detail::intrusiveSwapDisposers(disposer_, o.disposer_);
+    }
+
+    IntrusiveCircularList(IntrusiveCircularList&& o) noexcept
+        : disposer_(std::move(o.disposer_))
+    {
+        moveHead(o.head_, head_);
+    }
+
+    IntrusiveCircularList& operator=(IntrusiveCircularList&& o) noexcept
+    {
+        if (this != &o)
+        {
+            clear();
+            swap(o);
+        }
+
+        return *this;
+    }
+
+    bool empty() const noexcept
+    {
+        return head_.next == &head_;
+    }
+
+    // O(n)
+    size_t size() const noexcept
+    {
+        size_t n = 0;
+        for (auto h = head_.next; h != &head_; h = h->next)
+            ++n;
+
+        return n;
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(head_.next);
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(head_.next);
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(&head_);
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(const_cast<Hook*>(&head_));
+    }
+
+    reverse_iterator rbegin() noexcept
+    {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() noexcept
+    {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    // the position of an element known to be in this list
+    static iterator iterator_to(_Ty& item) noexcept
+    {
+        return iterator(&_Hook::get(item));
+    }
+
+    static const_iterator iterator_to(_Ty const& item) noexcept
+    {
+        return const_iterator(&_Hook::get(const_cast<_Ty&>(item)));
+    }
+
+    reference front()
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling front() on an empty list");
+        return *begin();
+    }
+
+    const_reference front() const
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling front() on an empty list");
+        return *begin();
+    }
+
+    reference back()
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling back() on an empty list");
+        return *iterator(head_.prev);
+    }
+
+    const_reference back() const
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling back() on an empty list");
+        return *const_iterator(head_.prev);
+    }
+
+    // links item in front of pos
+    iterator insert(const_iterator pos, _Ty* item) noexcept
+    {
+        assert(item);
+
+        auto& h = _Hook::get(*item);
+        assert(!h.linked());
+
+        auto next = pos.h_;
+        h.prev = next->prev;
+        h.next = next;
+        next->prev->next = &h;
+        next->prev = &h;
+
+        return iterator(&h);
+    }
+
+    void push_back(_Ty* item) noexcept
+    {
+        insert(end(), item);
+    }
+
+    void push_front(_Ty* item) noexcept
+    {
+        insert(begin(), item);
+    }
+
+    // takes item out of the list without disposing of it
+    _Ty* unlink(_Ty* item) noexcept
+    {
+        assert(item);
+
+        _Hook::get(*item).unlink();
+        return item;
+    }
+
+    void erase(_Ty* item) noexcept
+    {
+        disposer_(unlink(item));
+    }
+
+    // returns the element after the erased one
+    iterator erase(const_iterator pos) noexcept
+    {
+        assert(pos.h_ != &head_);
+
+        auto next = pos.h_->next;
+        erase(&_Hook::element(*pos.h_));
+        return iterator(next);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) noexcept
+    {
+        while (first != last)
+            first = erase(first);
+
+        return iterator(last.h_);
+    }
+
+    void pop_front()
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling pop_front() on an empty list");
+        erase(begin());
+    }
+
+    void pop_back()
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling pop_back() on an empty list");
+        erase(const_iterator(head_.prev));
+    }
+
+    void clear() noexcept
+    {
+        auto h = head_.next;
+        head_.prev = &head_;
+        head_.next = &head_;
+
+        while (h != &head_)
+        {
+            auto next = h->next;
+            h->prev = nullptr;
+            h->next = nullptr;
+            disposer_(&_Hook::element(*h));
+            h = next;
+        }
+    }
+
+    // moves the element at i, from this list or from o, in front of pos
+    void splice(const_iterator pos, IntrusiveCircularList& o, const_iterator i) noexcept
+    {
+        (void)o;
+        if (pos.h_ == i.h_ || pos.h_ == i.h_->next)
+            return;
+
+        auto h = i.h_;
+        h->unlink();
+        insert(pos, &_Hook::element(*h));
+    }
+
+    // moves [first, last) in front of pos; pos must not be inside the range
+    void splice(const_iterator pos, IntrusiveCircularList& o, const_iterator first, const_iterator last) noexcept
+    {
+        (void)o;
+        if (first == last || pos == first || pos == last)
+            return;
+
+        auto f = first.h_;
+        auto l = last.h_->prev;
+
+        // cut [f, l] out
+        f->prev->next = last.h_;
+        last.h_->prev = f->prev;
+
+        // and link it in front of pos
+        auto next = pos.h_;
+        f->prev = next->prev;
+        l->next = next;
+        next->prev->next = f;
+        next->prev = l;
+    }
+
+    // moves all of o in front of pos
+    void splice(const_iterator pos, IntrusiveCircularList& o) noexcept
+    {
+        if (&o != this)
+            splice(pos, o, o.begin(), o.end());
+    }
+
+private:
+    // the elements' first and last links point at the sentinel, so moving a list
+    // re-aims them at the new one; 'to' is not linked
+    static void moveHead(Hook& from, Hook& to) noexcept
+    {
+        if (from.next == &from)
+        {
+            to.prev = &to;
+            to.next = &to;
+        }
+        else
+        {
+            to.prev = from.prev;
+            to.next = from.next;
+            to.prev->next = &to;
+            to.next->prev = &to;
+        }
+
+        from.prev = &from;
+        from.next = &from;
+    }
+
+    Hook head_;
+    _Disposer disposer_;
+};
+
+
+} // namespace Util {}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "./IntrusiveList.hxx"
+#include "./murmurhash.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// a hash index over elements that carry their own chain link and cached hash,
+// so insert() and erase() never allocate; only the bucket array does when it
+// grows, and the elements can live in an IntrusiveList or a pool at the same time
+//
+// growing doesn't rehash everything at once: the old bucket array is kept and a
+// couple of its chains move over on every insert() and erase() until it is empty,
+// so no single operation pays for the whole table
+//
+// keys are unique; the table doesn't own its elements
+
+
+namespace Util
+{
+
+struct IntrusiveHashHook
+{
+    IntrusiveHashHook() = default;
+
+    // copies start unlinked, see IntrusiveListHook
+    IntrusiveHashHook(const IntrusiveHashHook&) noexcept
+    {
+    }
+
+    IntrusiveHashHook& operator=(const IntrusiveHashHook&) noexcept
+    {
+        return *this;
+    }
+
+    IntrusiveHashHook* next = nullptr;
+    size_t hash = 0;
+};
+
+template <typename _Ty>
+using IntrusiveHashBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, IntrusiveHashHook>;
+
+template <typename _Ty, IntrusiveHashHook _Ty::* _Member>
+using IntrusiveHashMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, IntrusiveHashHook, _Member>;
+
+
+// _KeyOf maps an element to its key, e.g. struct { int operator()(Conn const& c) const { return c.id; } }
+template <
+    typename _Ty,
+    typename _KeyOf,
+    typename _Hash = MurmurHash<Detail::IntrusiveKeyType<_Ty, _KeyOf>>,
+    typename _Hook = IntrusiveHashBaseHook<_Ty>,
+    typename _Equal = std::equal_to<>
+    >
+class IntrusiveHashTable
+{
+public:
+    using key_type = Detail::IntrusiveKeyType<_Ty, _KeyOf>;
+    using value_type = _Ty;
+    using size_type = std::size_t;
+    using hasher = _Hash;
+    using key_equal = _Equal;
+
+    using Hook = IntrusiveHashHook;
+
+    explicit IntrusiveHashTable(size_t buckets = 16, _KeyOf keyOf = _KeyOf(), _Hash hash = _Hash(), _Equal equal = _Equal())
+        : m_keyOf(std::move(keyOf))
+        , m_hash(std::move(hash))
+        , m_equal(std::move(equal))
+    {
+        size_t n = kMinBuckets;
+        while (n < buckets)
+            n *= 2;
+
+        m_buckets.assign(n, nullptr);
+    }
+
+    ~IntrusiveHashTable() noexcept
+    {
+        clear();
+    }
+
+    IntrusiveHashTable(const IntrusiveHashTable&) = delete;
+    IntrusiveHashTable& operator=(const IntrusiveHashTable&) = delete;
+
+    bool empty() const noexcept
+    {
+        return !m_size;
+    }
+
+    size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    size_t bucket_count() const noexcept
+    {
+        return m_buckets.size();
+    }
+
+    // true while an old bucket array is still being drained
+    bool rehashing() const noexcept
+    {
+        return !m_old.empty();
+    }
+
+    // false, and item is left alone, if an element with the same key is present;
+    // may throw std::bad_alloc when the bucket array grows, the table is unchanged then
+    bool insert(_Ty* item)
+    {
+        assert(item);
+
+        auto hash = m_hash(m_keyOf(*item));
+        if (findHook(m_keyOf(*item), hash))
+            return false;
+
+        if (m_size >= m_buckets.size())
+            grow();
+
+        auto& h = _Hook::get(*item);
+        auto& head = chainOf(hash);
+        h.hash = hash;
+        h.next = head;
+        head = &h;
+        ++m_size;
+
+        migrate();
+        return true;
+    }
+
+    template <typename _Key>
+    _Ty* find(_Key const& key) const noexcept
+    {
+        auto h = findHook(key, m_hash(key));
+        return h ? &_Hook::element(*h) : nullptr;
+    }
+
+    template <typename _Key>
+    bool contains(_Key const& key) const noexcept
+    {
+        return find(key) != nullptr;
+    }
+
+    // item must be in this table
+    void erase(_Ty* item) noexcept
+    {
+        assert(item);
+
+        auto& h = _Hook::get(*item);
+        auto link = &chainOf(h.hash);
+        while (*link != &h)
+        {
+            assert(*link);
+            link = &(*link)->next;
+        }
+
+        *link = h.next;
+        h.next = nullptr;
+        --m_size;
+
+        migrate();
+    }
+
+    // the unlinked element, or nullptr if the key isn't present
+    template <typename _Key>
+    _Ty* erase(_Key const& key) noexcept
+    {
+        auto item = find(key);
+        if (item)
+            erase(item);
+
+        return item;
+    }
+
+    // unlinks everything and drops back to the smallest bucket array
+    void clear() noexcept
+    {
+        forEach([](_Ty& item)
+        {
+            _Hook::get(item).next = nullptr;
+        });
+
+        m_old.clear();
+        m_old.shrink_to_fit();
+        m_migrated = 0;
+        m_buckets.assign(kMinBuckets, nullptr);
+        m_size = 0;
+    }
+
+    // fn(_Ty&) for every element, in no particular order; fn must not insert or erase
+    template <typename _Fn>
+    void forEach(_Fn fn) const
+    {
+        for (auto const* buckets : { &m_old, &m_buckets })
+        {
+            for (auto head : *buckets)
+            {
+                while (head)
+                {
+                    // fetch next first so fn may unlink the element
+                    auto next = head->next;
+                    fn(_Hook::element(*head));
+                    head = next;
+                }
+            }
+        }
+    }
+
+private:
+    static const size_t kMinBuckets = 8;
+
+    // old chains moved per insert() or erase()
+    static const size_t kMigrateStep = 2;
+
+    // the chain a hash lives in: the old array until its bucket has moved over
+    Hook*& chainOf(size_t hash) noexcept
+    {
+        if (!m_old.empty())
+        {
+            auto i = hash & (m_old.size() - 1);
+            if (i >= m_migrated)
+                return m_old[i];
+        }
+
+        return m_buckets[hash & (m_buckets.size() - 1)];
+    }
+
+    template <typename _Key>
+    Hook* findHook(_Key const& key, size_t hash) const noexcept
+    {
+        for (auto h = const_cast<IntrusiveHashTable*>(this)->chainOf(hash); h; h = h->next)
+        {
+            if (h->hash == hash && m_equal(m_keyOf(_Hook::element(*h)), key))
+                return h;
+        }
+
+        return nullptr;
+    }
+
+    void grow()
+    {
+        // a previous growth must be finished before its array can be the old one
+        while (!m_old.empty())
+            migrate();
+
+        std::vector<Hook*> buckets(m_buckets.size() * 2, nullptr);
+        m_old.swap(m_buckets);
+        m_buckets.swap(buckets);
+        m_migrated = 0;
+    }
+
+    void migrate() noexcept
+    {
+        if (m_old.empty())
+            return;
+
+        auto end = std::min(m_migrated + kMigrateStep, m_old.size());
+        for (; m_migrated < end; ++m_migrated)
+        {
+            auto h = m_old[m_migrated];
+            m_old[m_migrated] = nullptr;
+
+            while (h)
+            {
+                auto next = h->next;
+                auto& head = m_buckets[h->hash & (m_buckets.size() - 1)];
+                h->next = head;
+                head = h;
+                h = next;
+            }
+        }
+
+        if (m_migrated == m_old.size())
+        {
+            m_old.clear();
+            m_old.shrink_to_fit();
+            m_migrated = 0;
+        }
+    }
+
+    std::vector<Hook*> m_buckets;
+    std::vector<Hook*> m_old;       // being drained into m_buckets, empty otherwise
+    size_t m_migrated = 0;          // m_old[0, m_migrated) have moved
+    size_t m_size = 0;
+    _KeyOf m_keyOf;
+    _Hash m_hash;
+    _Equal m_equal;
+};
+
+
+} // namespace Util {}
@@ -1,75 +1,227 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iterator>
+#include <type_traits>
 #include <utility>
 
 namespace Util
 {
 
+namespace Detail
+{
+
+// offsetof() for a member pointer, measured against a fake, suitably aligned
+// address; lets member hooks get from a hook back to its element
+template <typename _Ty, typename _Member>
+size_t intrusiveMemberOffset(_Member _Ty::* member) noexcept
+{
+    const uintptr_t kBase = alignof(_Ty) * 16;
+    return size_t(reinterpret_cast<uintptr_t>(&(reinterpret_cast<_Ty*>(kBase)->*member)) - kBase);
+}
+
+template <typename _Ty, typename _Member>
+_Ty& intrusiveElement(_Member& hook, _Member _Ty::* member) noexcept
+{
+    return *reinterpret_cast<_Ty*>(reinterpret_cast<char*>(&hook) - intrusiveMemberOffset(member));
+}
+
+// what a _KeyOf of a keyed intrusive container returns for an element, minus
+// references and const
+template <typename _Ty, typename _KeyOf>
+using IntrusiveKeyType = typename std::decay<decltype(std::declval<_KeyOf>()(std::declval<_Ty const&>()))>::type;
+
+// hook traits of every intrusive container: get() finds the _Hook of an element,
+// element() goes back from a hook; the hook is a base class of the element...
+template <typename _Ty, typename _Hook>
+struct IntrusiveBaseHookTraits
+{
+    static _Hook& get(_Ty& v) noexcept
+    {
+        return v;
+    }
+
+    static _Ty& element(_Hook& h) noexcept
+    {
+        return static_cast<_Ty&>(h);
+    }
+};
+
+// ...or a data member of it
+template <typename _Ty, typename _Hook, _Hook _Ty::* _Member>
+struct IntrusiveMemberHookTraits
+{
+    static _Hook& get(_Ty& v) noexcept
+    {
+        return v.*_Member;
+    }
+
+    static _Ty& element(_Hook& h) noexcept
+    {
+        return intrusiveElement(h, _Member);
+    }
+};
+
+} // namespace Detail {}
+
+
+// the links an element needs to be in one IntrusiveList; no virtual functions,
+// so it costs exactly two pointers
+//
+// _Tag tells apart several of them as base classes of one element, which is
+// then in as many lists at once, e.g.
+//   struct Conn : IntrusiveListHook<Conn, ReadyTag>, IntrusiveListHook<Conn, AllTag> { ... };
+//   IntrusiveList<Conn, ReadyTag, IntrusiveNoDispose> ready;
+// tags are only names, any type will do, even an incomplete one
+//
+// all intrusive hooks copy the same way: a place in a container belongs to the
+// element it was linked as, so a copied or moved element starts out unlinked,
+// the original stays where it was, and assignment leaves both hooks alone
+template <typename _Ty, typename _Tag = void>
+struct IntrusiveListHook
+{
+    IntrusiveListHook() = default;
+
+    explicit IntrusiveListHook(_Ty* prev, _Ty* next) noexcept
+        : prev(prev)
+        , next(next)
+    {}
+
+    IntrusiveListHook(const IntrusiveListHook&) noexcept
+    {
+    }
+
+    IntrusiveListHook& operator=(const IntrusiveListHook&) noexcept
+    {
+        return *this;
+    }
+
+    _Ty* prev = nullptr;
+    _Ty* next = nullptr;
+};
+
+// the original base hook; the virtual destructor lets a list of _Ty delete
+// objects derived from _Ty
 template <typename _Ty>
-class IntrusiveList
+struct IntrusiveListNode
+    : public IntrusiveListHook<_Ty>
 {
-public:
-    using value_type = _Ty;
-    using size_type = std::size_t;
-    using difference_type = std::ptrdiff_t;
-    using pointer = _Ty *;
-    using const_pointer = _Ty const *;
-    using reference = _Ty &;
-    using const_reference = _Ty const &;
+    virtual ~IntrusiveListNode() = default;
+    IntrusiveListNode() = default;
+
+    explicit IntrusiveListNode(_Ty* prev, _Ty* next) noexcept
+        : IntrusiveListHook<_Ty>(prev, next)
+    {}
+
+    IntrusiveListNode(const IntrusiveListNode&) = default;
+    IntrusiveListNode& operator=(const IntrusiveListNode&) = default;
 
-    struct Node
+    void unlink() noexcept
     {
-        virtual ~Node() = default;
-        Node() = default;
+        if (this->next)
+            this->next->prev = this->prev;
 
-        explicit Node(Node* prev, Node* next) noexcept
-            : prev(prev)
-            , next(next)
-        {}
+        if (this->prev)
+            this->prev->next = this->next;
 
-        Node(const Node&) = delete;
-        Node& operator=(const Node&) = delete;
+        this->prev = nullptr;
+        this->next = nullptr;
+    }
+};
 
-        void swap(Node& o) noexcept
-        {
-            using std::swap;
-            swap(prev, o.prev);
-            swap(next, o.next);
-        }
+// how a list finds the hook of an element: a base class...
+template <typename _Ty, typename _Tag = void>
+using IntrusiveBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, IntrusiveListHook<_Ty, _Tag>>;
+
+// ...or a data member, e.g. IntrusiveMemberHook<Conn, &Conn::readyHook>
+template <typename _Ty, IntrusiveListHook<_Ty> _Ty::* _Member>
+using IntrusiveMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, IntrusiveListHook<_Ty>, _Member>;
+
+// what erase() and clear() do with an element once it is unlinked; any callable
+// taking _Ty* works, e.g. one that hands the element back to its pool
+//
+// a moved-from list hands its disposer on with its elements; swap() and move
+// assignment exchange disposers only if they are assignable, so a capturing
+// lambda stays with the list it was given to (move assignment disposes of the
+// old elements with it first)
+struct IntrusiveDelete
+{
+    template <typename _Ty>
+    void operator()(_Ty* p) const noexcept
+    {
+        delete p;
+    }
+};
 
-        Node(Node&& o) noexcept
-            : Node()
-        {
-            o.swap(*this);
-        }
+// for lists that don't own their elements
+struct IntrusiveNoDispose
+{
+    template <typename _Ty>
+    void operator()(_Ty*) const noexcept
+    {
+    }
+};
 
-        Node& operator=(Node&& o) noexcept
-        {
-            if (this != &o)
-            {
-                Node(std::move(o)).swap(*this);
-            }
 
-            return *this;
-        }
+namespace Detail
+{
 
-        void unlink() noexcept
-        {
-            if (next)
-                next->prev = prev;
+template <typename _Disposer>
+void intrusiveSwapDisposers(_Disposer& a, _Disposer& b, std::true_type) noexcept
+{
+    using std::swap;
+    swap(a, b);
+}
 
-            if (prev)
-                prev->next = next;
+template <typename _Disposer>
+void intrusiveSwapDisposers(_Disposer&, _Disposer&, std::false_type) noexcept
+{
+}
 
-            prev = nullptr;
-            next = nullptr;
-        }
+template <typename _Disposer>
+void intrusiveSwapDisposers(_Disposer& a, _Disposer& b) noexcept
+{
+    intrusiveSwapDisposers(a, b, typename std::is_move_assignable<_Disposer>::type());
+}
 
-        _Ty* prev = nullptr;
-        _Ty* next = nullptr;
-    };
+// the _Hook of an IntrusiveList is hook traits, anything with a static get(_Ty&),
+// or else the tag of one of the element's IntrusiveListHook bases
+template <typename _Ty, typename _HookOrTag, typename = void>
+struct IntrusiveListTraits
+{
+    using type = IntrusiveBaseHook<_Ty, _HookOrTag>;
+};
+
+template <typename _Ty, typename _HookOrTag>
+struct IntrusiveListTraits<_Ty, _HookOrTag, decltype(void(_HookOrTag::get(std::declval<_Ty&>())))>
+{
+    using type = _HookOrTag;
+};
+
+} // namespace Detail {}
+
+
+// _Hook is hook traits, IntrusiveBaseHook or IntrusiveMemberHook, or just the tag
+// of the IntrusiveListHook base to link through
+template <typename _Ty, typename _Hook = IntrusiveBaseHook<_Ty>, typename _Disposer = IntrusiveDelete>
+class IntrusiveList
+{
+    using Traits = typename Detail::IntrusiveListTraits<_Ty, _Hook>::type;
+
+public:
+    using value_type = _Ty;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = _Ty *;
+    using const_pointer = _Ty const *;
+    using reference = _Ty &;
+    using const_reference = _Ty const &;
+
+    using Hook = typename std::remove_reference<decltype(Traits::get(std::declval<_Ty&>()))>::type;
+    using Node = IntrusiveListNode<_Ty>;
 
     struct const_iterator
     {
@@ -97,7 +249,7 @@ public:
         {
             if (m)
             {
-                m = m->next;
+                m = hook(m).next;
             }
 
             return *this;
@@ -149,7 +301,7 @@ public:
         {
             if (m)
             {
-                m = m->next;
+                m = hook(m).next;
             }
 
             return *this;
@@ -192,6 +344,11 @@ public:
 
 	IntrusiveList() = default;
 
+	explicit IntrusiveList(_Disposer disposer)
+		: disposer_(std::move(disposer))
+	{
+	}
+
 	IntrusiveList(const IntrusiveList&) = delete;
 	IntrusiveList& operator=(const IntrusiveList&) = delete;
 
@@ -201,18 +358,27 @@ public:
 		swap(first_, o.first_);
 		swap(last_, o.last_);
 		swap(count_, o.count_);
+		Detail::intrusiveSwapDisposers(disposer_, o.disposer_);
 	}
 
 	IntrusiveList(IntrusiveList&& o) noexcept
-		: IntrusiveList()
+		: first_(o.first_)
+		, last_(o.last_)
+		, count_(o.count_)
+		, disposer_(std::move(o.disposer_))
 	{
-		o.swap(*this);
+		o.first_ = nullptr;
+		o.last_ = nullptr;
+		o.count_ = 0;
 	}
 
 	IntrusiveList& operator=(IntrusiveList&& o) noexcept
 	{
 		if (this != &o)
-			IntrusiveList(std::move(o)).swap(*this);
+		{
+			clear();
+			swap(o);
+		}
 
 		return *this;
 	}
@@ -283,19 +449,22 @@ public:
 	{
 		assert(item);
 
+		auto& h = hook(item);
 		if (!last_) // empty list
 		{
 			assert(!first_);
 			first_ = item;
 			last_ = item;
+			h.prev = nullptr;
+			h.next = nullptr;
 		}
 		else // non-empty list
 		{
 			auto prev = last_;
 			last_ = item;
-			item->prev = prev;
-			item->next = nullptr;
-			prev->next = item;
+			h.prev = prev;
+			h.next = nullptr;
+			hook(prev).next = item;
 		}
 
 		++count_;
@@ -305,60 +474,59 @@ public:
 	{
 		assert(item);
 
+		auto& h = hook(item);
 		if (!first_) // empty list
 		{
 			assert(!last_);
 			first_ = item;
 			last_ = item;
+			h.prev = nullptr;
+			h.next = nullptr;
 		}
 		else // non-empty list
 		{
 			auto next = first_;
 			first_ = item;
-			item->prev = nullptr;
-			item->next = next;
-			next->prev = item;
+			h.prev = nullptr;
+			h.next = next;
+			hook(next).prev = item;
 		}
 
 		++count_;
 	}
 
-	void erase(_Ty* item) noexcept
+	// takes item out of the list without disposing of it
+	_Ty* unlink(_Ty* item) noexcept
 	{
 		assert(item);
+		assert(!empty());
 
-		if (empty())
-			return;
-
-		if (item->next)
-		{
-			item->next->prev = item->prev;
-			item->next->next = item->next->next;
-		}
+		auto& h = hook(item);
+		if (h.next)
+			hook(h.next).prev = h.prev;
 		else
-		{
-			last_ = item->prev;
-		}
+			last_ = h.prev;
 
-		if (item->prev)
-		{
-			item->prev->next = item->next;
-			item->prev->prev = item->prev->prev;
-		}
+		if (h.prev)
+			hook(h.prev).next = h.next;
 		else
-		{
-			first_ = item->next;
-		}
-
-		item->unlink();
-        delete item;
+			first_ = h.next;
 
+		h.prev = nullptr;
+		h.next = nullptr;
 		--count_;
-		if (!count_)
-		{
-			first_ = nullptr;
-			last_ = nullptr;
-		}
+
+		return item;
+	}
+
+	void erase(_Ty* item) noexcept
+	{
+		assert(item);
+
+		if (empty())
+			return;
+
+		disposer_(unlink(item));
 	}
 
     void erase(iterator i) noexcept
@@ -390,18 +558,138 @@ public:
 		last_ = nullptr;
 		while (p)
 		{
-			auto next = p->next;
-			p->unlink();
-            delete p;
+			auto& h = hook(p);
+			auto next = h.next;
+			h.prev = nullptr;
+			h.next = nullptr;
+			disposer_(p);
 			--count_;
 			p = next;
 		}
 	}
+
+	// stable bottom-up merge sort; elements are relinked, never moved or copied,
+	// and nothing is allocated; cmp must not throw
+	template <typename _Compare>
+	void sort(_Compare cmp)
+	{
+		if (count_ < 2)
+			return;
+
+		// runs[i] is empty or a sorted run of 2^i elements, linked through next
+		// only; higher runs hold earlier elements
+		_Ty* runs[64] = {};
+		size_t used = 0;
+
+		auto p = first_;
+		while (p)
+		{
+			auto next = hook(p).next;
+			hook(p).next = nullptr;
+
+			auto run = p;
+			size_t i = 0;
+			for (; i < used && runs[i]; ++i)
+			{
+				run = mergeRuns(runs[i], run, cmp);
+				runs[i] = nullptr;
+			}
+
+			runs[i] = run;
+			if (i == used)
+				++used;
+
+			p = next;
+		}
+
+		_Ty* run = nullptr;
+		for (size_t i = 0; i < used; ++i)
+		{
+			if (runs[i])
+				run = run ? mergeRuns(runs[i], run, cmp) : runs[i];
+		}
+
+		relink(run);
+	}
+
+	void sort()
+	{
+		sort(std::less<>());
+	}
+
+	// merges the sorted list o into this sorted list and leaves o empty; of equal
+	// elements, the ones from this list come first
+	template <typename _Compare>
+	void merge(IntrusiveList& o, _Compare cmp)
+	{
+		if (&o == this || o.empty())
+			return;
+
+		if (last_)
+			hook(last_).next = nullptr;
+
+		auto run = mergeRuns(first_, o.first_, cmp);
+		count_ += o.count_;
+
+		o.first_ = nullptr;
+		o.last_ = nullptr;
+		o.count_ = 0;
+
+		relink(run);
+	}
+
+	void merge(IntrusiveList& o)
+	{
+		merge(o, std::less<>());
+	}
     	
 protected:
+	static Hook& hook(const _Ty* item) noexcept
+	{
+		return Traits::get(*const_cast<_Ty*>(item));
+	}
+
+	// merges two null-terminated chains linked through next; a goes first on ties
+	template <typename _Compare>
+	static _Ty* mergeRuns(_Ty* a, _Ty* b, _Compare& cmp)
+	{
+		_Ty* head = nullptr;
+		_Ty** tail = &head;
+		while (a && b)
+		{
+			// selects rather than branches; on unsorted input the comparison is a coin flip
+			bool takeB = cmp(*b, *a);
+			auto p = takeB ? b : a;
+			auto next = hook(p).next;
+			*tail = p;
+			tail = &hook(p).next;
+			a = takeB ? a : next;
+			b = takeB ? next : b;
+		}
+
+		*tail = a ? a : b;
+		return head;
+	}
+
+	// rebuilds prev links, first_ and last_ from a chain linked through next
+	void relink(_Ty* head) noexcept
+	{
+		first_ = head;
+
+		_Ty* prev = nullptr;
+		for (auto p = head; p; p = hook(p).next)
+		{
+			hook(p).prev = prev;
+			prev = p;
+		}
+
+		last_ = prev;
+	}
+
 	_Ty* first_ = nullptr;
 	_Ty* last_ = nullptr;
 	size_t count_ = 0;
+	_Disposer disposer_;
 };
 
 
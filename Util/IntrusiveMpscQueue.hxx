@@ -0,0 +1,176 @@
+#pragma once
+
+#include "./IntrusiveList.hxx"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+
+// intrusive multi-producer, single-consumer FIFO (Vyukov): a push is one atomic
+// exchange plus one store and never waits for the consumer or other producers;
+// only one thread may pop at a time
+//
+// the queue doesn't own its elements, a popped element belongs to the consumer;
+// while a producer is between its exchange and its store, pop() can't see past
+// that element yet and returns nullptr even though later elements exist
+
+
+namespace Util
+{
+
+struct IntrusiveMpscHook
+{
+    IntrusiveMpscHook() = default;
+
+    // copies start unlinked, see IntrusiveListHook
+    IntrusiveMpscHook(const IntrusiveMpscHook&) noexcept
+    {
+    }
+
+    IntrusiveMpscHook& operator=(const IntrusiveMpscHook&) noexcept
+    {
+        return *this;
+    }
+
+    std::atomic<IntrusiveMpscHook*> next{ nullptr };
+};
+
+template <typename _Ty>
+using IntrusiveMpscBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, IntrusiveMpscHook>;
+
+template <typename _Ty, IntrusiveMpscHook _Ty::* _Member>
+using IntrusiveMpscMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, IntrusiveMpscHook, _Member>;
+
+
+template <typename _Ty, typename _Hook = IntrusiveMpscBaseHook<_Ty>>
+class IntrusiveMpscQueue
+{
+public:
+    using Hook = IntrusiveMpscHook;
+
+    ~IntrusiveMpscQueue() noexcept
+    {
+        assert(empty());
+    }
+
+    IntrusiveMpscQueue() noexcept
+        : m_head(&m_stub)
+        , m_tail(&m_stub)
+    {
+    }
+
+    // the stub node lives inside the queue, so it can't move
+    IntrusiveMpscQueue(const IntrusiveMpscQueue&) = delete;
+    IntrusiveMpscQueue& operator=(const IntrusiveMpscQueue&) = delete;
+
+    // any thread
+    void push(_Ty* item) noexcept
+    {
+        assert(item);
+        link(&_Hook::get(*item));
+    }
+
+    // consumer only; nothing ready or a push still in progress
+    bool empty() const noexcept
+    {
+        return m_tail == &m_stub && !m_stub.next.load(std::memory_order_acquire);
+    }
+
+    // consumer only; the oldest element or nullptr
+    _Ty* pop() noexcept
+    {
+        auto tail = m_tail;
+        auto next = tail->next.load(std::memory_order_acquire);
+
+        // skip the stub
+        if (tail == &m_stub)
+        {
+            if (!next)
+                return nullptr;
+
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+
+        if (next)
+        {
+            m_tail = next;
+            return release(tail);
+        }
+
+        // tail is the last element unless a producer has already swung m_head
+        // past it and not linked it yet
+        if (tail != m_head.load(std::memory_order_acquire))
+            return nullptr;
+
+        // put the stub behind tail so tail can be handed out
+        link(&m_stub);
+
+        next = tail->next.load(std::memory_order_acquire);
+        if (next)
+        {
+            m_tail = next;
+            return release(tail);
+        }
+
+        return nullptr;
+    }
+
+    // consumer only; pops up to max elements into out, oldest first
+    size_t pop(_Ty** out, size_t max) noexcept
+    {
+        size_t n = 0;
+        while (n < max)
+        {
+            auto item = pop();
+            if (!item)
+                break;
+
+            out[n++] = item;
+        }
+
+        return n;
+    }
+
+    // consumer only; calls fn(_Ty*) for everything that is ready, oldest first
+    template <typename _Fn>
+    size_t consume(_Fn fn, size_t max = size_t(-1))
+    {
+        size_t n = 0;
+        while (n < max)
+        {
+            auto item = pop();
+            if (!item)
+                break;
+
+            ++n;
+            fn(item);
+        }
+
+        return n;
+    }
+
+private:
+    void link(Hook* h) noexcept
+    {
+        h->next.store(nullptr, std::memory_order_relaxed);
+        auto prev = m_head.exchange(h, std::memory_order_acq_rel);
+        prev->next.store(h, std::memory_order_release);
+    }
+
+    static _Ty* release(Hook* h) noexcept
+    {
+        h->next.store(nullptr, std::memory_order_relaxed);
+        return &_Hook::element(*h);
+    }
+
+    // producers hammer m_head, the consumer owns m_tail; keep them apart
+    alignas(64) std::atomic<Hook*> m_head;
+    alignas(64) Hook* m_tail;
+    Hook m_stub;
+};
+
+
+} // namespace Util {}
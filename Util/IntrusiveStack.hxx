@@ -0,0 +1,161 @@
+#pragma once
+
+#include "./IntrusiveList.hxx"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+
+// lock-free intrusive LIFO (Treiber) for freelists; any number of threads may
+// push and pop
+//
+// the top pointer carries a tag that changes with every update, so a pop that
+// read A -> B can't succeed after A was popped and pushed back on top of
+// something else (ABA); on x64 the tag lives in the 16 unused high bits of the
+// pointer, on x86 the pointer and a 32 bit tag share one 64 bit CAS
+//
+// pop() reads the next link of an element another thread may have just popped,
+// so memory of popped elements must stay readable: fine for pooled objects, not
+// for ones that go back to the heap
+
+
+namespace Util
+{
+
+struct IntrusiveStackHook
+{
+    IntrusiveStackHook() = default;
+
+    // copies start unlinked, see IntrusiveListHook
+    IntrusiveStackHook(const IntrusiveStackHook&) noexcept
+    {
+    }
+
+    IntrusiveStackHook& operator=(const IntrusiveStackHook&) noexcept
+    {
+        return *this;
+    }
+
+    // atomic only because a losing pop() may read it while it is rewritten
+    std::atomic<IntrusiveStackHook*> next{ nullptr };
+};
+
+template <typename _Ty>
+using IntrusiveStackBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, IntrusiveStackHook>;
+
+template <typename _Ty, IntrusiveStackHook _Ty::* _Member>
+using IntrusiveStackMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, IntrusiveStackHook, _Member>;
+
+
+template <typename _Ty, typename _Hook = IntrusiveStackBaseHook<_Ty>>
+class IntrusiveStack
+{
+public:
+    using Hook = IntrusiveStackHook;
+
+    IntrusiveStack() noexcept
+        : m_top(0)
+    {
+    }
+
+    IntrusiveStack(const IntrusiveStack&) = delete;
+    IntrusiveStack& operator=(const IntrusiveStack&) = delete;
+
+    bool empty() const noexcept
+    {
+        return !pointer(m_top.load(std::memory_order_relaxed));
+    }
+
+    void push(_Ty* item) noexcept
+    {
+        assert(item);
+
+        auto h = &_Hook::get(*item);
+        link(h, h);
+    }
+
+    // pushes a chain linked through the hooks, e.g. one from pop_all(), with a
+    // single CAS; first ends up on top
+    void push(_Ty* first, _Ty* last) noexcept
+    {
+        assert(first && last);
+        link(&_Hook::get(*first), &_Hook::get(*last));
+    }
+
+    _Ty* pop() noexcept
+    {
+        auto top = m_top.load(std::memory_order_acquire);
+        for (;;)
+        {
+            auto h = pointer(top);
+            if (!h)
+                return nullptr;
+
+            // h may be popped and reused meanwhile; then next is stale but the
+            // tag has moved on and the CAS fails
+            auto next = h->next.load(std::memory_order_relaxed);
+            if (m_top.compare_exchange_weak(top, pack(next, tag(top) + 1), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                h->next.store(nullptr, std::memory_order_relaxed);
+                return &_Hook::element(*h);
+            }
+        }
+    }
+
+    // takes everything at once; walk the result with next()
+    _Ty* pop_all() noexcept
+    {
+        auto top = m_top.load(std::memory_order_acquire);
+        while (pointer(top) && !m_top.compare_exchange_weak(top, pack(nullptr, tag(top) + 1), std::memory_order_acquire, std::memory_order_acquire))
+        {
+        }
+
+        auto h = pointer(top);
+        return h ? &_Hook::element(*h) : nullptr;
+    }
+
+    // the element below item in a chain taken with pop_all()
+    static _Ty* next(_Ty* item) noexcept
+    {
+        auto h = _Hook::get(*item).next.load(std::memory_order_relaxed);
+        return h ? &_Hook::element(*h) : nullptr;
+    }
+
+private:
+    // x64 user mode addresses fit in 48 bits
+    static const unsigned kTagShift = (sizeof(void*) == 8) ? 48 : 32;
+    static const uint64_t kPointerMask = (uint64_t(1) << kTagShift) - 1;
+
+    static uint64_t pack(Hook* h, uint64_t tag) noexcept
+    {
+        assert((uint64_t(reinterpret_cast<uintptr_t>(h)) & ~kPointerMask) == 0);
+        return uint64_t(reinterpret_cast<uintptr_t>(h)) | (tag << kTagShift);
+    }
+
+    static Hook* pointer(uint64_t v) noexcept
+    {
+        return reinterpret_cast<Hook*>(uintptr_t(v & kPointerMask));
+    }
+
+    static uint64_t tag(uint64_t v) noexcept
+    {
+        return v >> kTagShift;
+    }
+
+    void link(Hook* first, Hook* last) noexcept
+    {
+        auto top = m_top.load(std::memory_order_relaxed);
+        do
+        {
+            last->next.store(pointer(top), std::memory_order_relaxed);
+        }
+        while (!m_top.compare_exchange_weak(top, pack(first, tag(top) + 1), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // pointer | tag << kTagShift; 8 byte aligned so x86 gets a lock-free cmpxchg8b
+    alignas(8) std::atomic<uint64_t> m_top;
+};
+
+
+} // namespace Util {}
@@ -0,0 +1,886 @@
+#pragma once
+
+#include "./IntrusiveList.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+
+// an ordered index (red-black tree) over elements that carry their own node
+// links, so insert() and erase() never allocate and an element can be erased in
+// O(log n) knowing nothing but the element itself
+//
+// the tree is closed by a header hook inside the tree object: its parent is the
+// root, its left and right are the first and last elements, and end() is the
+// header, so begin(), rbegin() and --end() are O(1)
+//
+// IntrusiveSet keeps keys unique, IntrusiveMultiSet keeps equal keys in
+// insertion order; neither owns its elements
+
+
+namespace Util
+{
+
+struct IntrusiveTreeHook
+{
+    IntrusiveTreeHook() = default;
+
+    // copies start unlinked, see IntrusiveListHook
+    IntrusiveTreeHook(const IntrusiveTreeHook&) noexcept
+    {
+    }
+
+    IntrusiveTreeHook& operator=(const IntrusiveTreeHook&) noexcept
+    {
+        return *this;
+    }
+
+    bool linked() const noexcept
+    {
+        return parent != nullptr;
+    }
+
+    IntrusiveTreeHook* parent = nullptr;
+    IntrusiveTreeHook* left = nullptr;
+    IntrusiveTreeHook* right = nullptr;
+    bool red = false;
+};
+
+template <typename _Ty>
+using IntrusiveTreeBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, IntrusiveTreeHook>;
+
+template <typename _Ty, IntrusiveTreeHook _Ty::* _Member>
+using IntrusiveTreeMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, IntrusiveTreeHook, _Member>;
+
+
+namespace Detail
+{
+
+// the rebalancing doesn't depend on the element type, so it is written once
+// against bare hooks; the header is red, which is how decrement tells it from
+// the root
+
+inline IntrusiveTreeHook* treeMinimum(IntrusiveTreeHook* h) noexcept
+{
+    while (h->left)
+        h = h->left;
+
+    return h;
+}
+
+inline IntrusiveTreeHook* treeMaximum(IntrusiveTreeHook* h) noexcept
+{
+    while (h->right)
+        h = h->right;
+
+    return h;
+}
+
+// the next hook in order; the last element's next is the header
+inline IntrusiveTreeHook* treeIncrement(IntrusiveTreeHook* h) noexcept
+{
+    if (h->right)
+        return treeMinimum(h->right);
+
+    auto p = h->parent;
+    while (h == p->right)
+    {
+        h = p;
+        p = p->parent;
+    }
+
+    // h only ends up right of p when climbing out of the last element, which
+    // lands on the header
+    return (h->right != p) ? p : h;
+}
+
+// the previous hook in order; the header's previous is the last element
+inline IntrusiveTreeHook* treeDecrement(IntrusiveTreeHook* h) noexcept
+{
+    if (h->red && h->parent->parent == h)
+        return h->right;
+
+    if (h->left)
+        return treeMaximum(h->left);
+
+    auto p = h->parent;
+    while (h == p->left)
+    {
+        h = p;
+        p = p->parent;
+    }
+
+    return p;
+}
+
+inline void treeRotateLeft(IntrusiveTreeHook* x, IntrusiveTreeHook*& root) noexcept
+{
+    auto y = x->right;
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+
+    y->parent = x->parent;
+    if (x == root)
+        root = y;
+    else if (x == x->parent->left)
+        x->parent->left = y;
+    else
+        x->parent->right = y;
+
+    y->left = x;
+    x->parent = y;
+}
+
+inline void treeRotateRight(IntrusiveTreeHook* x, IntrusiveTreeHook*& root) noexcept
+{
+    auto y = x->left;
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+
+    y->parent = x->parent;
+    if (x == root)
+        root = y;
+    else if (x == x->parent->right)
+        x->parent->right = y;
+    else
+        x->parent->left = y;
+
+    y->right = x;
+    x->parent = y;
+}
+
+// links x as the left or right child of p, which has no child on that side,
+// and restores the red-black properties
+inline void treeInsert(bool left, IntrusiveTreeHook* x, IntrusiveTreeHook* p, IntrusiveTreeHook& header) noexcept
+{
+    auto& root = header.parent;
+
+    x->parent = p;
+    x->left = nullptr;
+    x->right = nullptr;
+    x->red = true;
+
+    if (left)
+    {
+        // p is the header when the tree is empty, which makes x the first element
+        p->left = x;
+        if (p == &header)
+        {
+            header.parent = x;
+            header.right = x;
+        }
+        else if (p == header.left)
+        {
+            header.left = x;
+        }
+    }
+    else
+    {
+        p->right = x;
+        if (p == header.right)
+            header.right = x;
+    }
+
+    while (x != root && x->parent->red)
+    {
+        auto g = x->parent->parent;
+        if (x->parent == g->left)
+        {
+            auto uncle = g->right;
+            if (uncle && uncle->red)
+            {
+                x->parent->red = false;
+                uncle->red = false;
+                g->red = true;
+                x = g;
+            }
+            else
+            {
+                if (x == x->parent->right)
+                {
+                    x = x->parent;
+                    treeRotateLeft(x, root);
+                }
+
+                x->parent->red = false;
+                g->red = true;
+                treeRotateRight(g, root);
+            }
+        }
+        else
+        {
+            auto uncle = g->left;
+            if (uncle && uncle->red)
+            {
+                x->parent->red = false;
+                uncle->red = false;
+                g->red = true;
+                x = g;
+            }
+            else
+            {
+                if (x == x->parent->left)
+                {
+                    x = x->parent;
+                    treeRotateRight(x, root);
+                }
+
+                x->parent->red = false;
+                g->red = true;
+                treeRotateLeft(g, root);
+            }
+        }
+    }
+
+    root->red = false;
+}
+
+// unlinks z and restores the red-black properties; z's links are left stale
+inline void treeErase(IntrusiveTreeHook* z, IntrusiveTreeHook& header) noexcept
+{
+    auto& root = header.parent;
+    auto& first = header.left;
+    auto& last = header.right;
+
+    // y is the hook that actually leaves its position: z itself when it has at
+    // most one child, its successor otherwise; x takes y's place
+    auto y = z;
+    IntrusiveTreeHook* x = nullptr;
+    IntrusiveTreeHook* xParent = nullptr;
+
+    if (!y->left)
+    {
+        x = y->right;
+    }
+    else if (!y->right)
+    {
+        x = y->left;
+    }
+    else
+    {
+        y = treeMinimum(y->right);
+        x = y->right;
+    }
+
+    if (y != z)
+    {
+        // move the successor into z's position
+        z->left->parent = y;
+        y->left = z->left;
+        if (y != z->right)
+        {
+            xParent = y->parent;
+            if (x)
+                x->parent = y->parent;
+
+            y->parent->left = x;
+            y->right = z->right;
+            z->right->parent = y;
+        }
+        else
+        {
+            xParent = y;
+        }
+
+        if (root == z)
+            root = y;
+        else if (z->parent->left == z)
+            z->parent->left = y;
+        else
+            z->parent->right = y;
+
+        y->parent = z->parent;
+        std::swap(y->red, z->red);
+
+        // z's colour is now the one that left the tree
+        y = z;
+    }
+    else
+    {
+        xParent = y->parent;
+        if (x)
+            x->parent = y->parent;
+
+        if (root == z)
+            root = x;
+        else if (z->parent->left == z)
+            z->parent->left = x;
+        else
+            z->parent->right = x;
+
+        if (first == z)
+            first = z->right ? treeMinimum(x) : z->parent;
+
+        if (last == z)
+            last = z->left ? treeMaximum(x) : z->parent;
+    }
+
+    if (y->red)
+        return;
+
+    // a black hook left, so the path through x is one black short
+    while (x != root && (!x || !x->red))
+    {
+        if (x == xParent->left)
+        {
+            auto w = xParent->right;
+            if (w->red)
+            {
+                w->red = false;
+                xParent->red = true;
+                treeRotateLeft(xParent, root);
+                w = xParent->right;
+            }
+
+            if ((!w->left || !w->left->red) && (!w->right || !w->right->red))
+            {
+                w->red = true;
+                x = xParent;
+                xParent = xParent->parent;
+            }
+            else
+            {
+                if (!w->right || !w->right->red)
+                {
+                    w->left->red = false;
+                    w->red = true;
+                    treeRotateRight(w, root);
+                    w = xParent->right;
+                }
+
+                w->red = xParent->red;
+                xParent->red = false;
+                if (w->right)
+                    w->right->red = false;
+
+                treeRotateLeft(xParent, root);
+                break;
+            }
+        }
+        else
+        {
+            auto w = xParent->left;
+            if (w->red)
+            {
+                w->red = false;
+                xParent->red = true;
+                treeRotateRight(xParent, root);
+                w = xParent->left;
+            }
+
+            if ((!w->right || !w->right->red) && (!w->left || !w->left->red))
+            {
+                w->red = true;
+                x = xParent;
+                xParent = xParent->parent;
+            }
+            else
+            {
+                if (!w->left || !w->left->red)
+                {
+                    w->right->red = false;
+                    w->red = true;
+                    treeRotateLeft(w, root);
+                    w = xParent->left;
+                }
+
+                w->red = xParent->red;
+                xParent->red = false;
+                if (w->left)
+                    w->left->red = false;
+
+                treeRotateRight(xParent, root);
+                break;
+            }
+        }
+    }
+
+    if (x)
+        x->red = false;
+}
+
+} // namespace Detail {}
+
+
+// _KeyOf maps an element to its key, e.g. struct { uint64_t operator()(Timeout const& t) const { return t.deadline; } }
+template <
+    typename _Ty,
+    typename _KeyOf,
+    typename _Compare = std::less<>,
+    typename _Hook = IntrusiveTreeBaseHook<_Ty>,
+    bool _Unique = true
+    >
+class IntrusiveTree
+{
+public:
+    using key_type = Detail::IntrusiveKeyType<_Ty, _KeyOf>;
+    using value_type = _Ty;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = _Ty *;
+    using const_pointer = _Ty const *;
+    using reference = _Ty &;
+    using const_reference = _Ty const &;
+    using key_compare = _Compare;
+
+    using Hook = IntrusiveTreeHook;
+
+    template <typename _Ref, typename _Ptr>
+    class basic_iterator
+    {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = typename IntrusiveTree::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = _Ptr;
+        using reference = _Ref;
+
+        basic_iterator() noexcept = default;
+
+        explicit basic_iterator(Hook* h) noexcept
+            : h_(h)
+        {
+        }
+
+        // iterator -> const_iterator
+        template <typename _R, typename _P, typename = typename std::enable_if<std::is_convertible<_P, _Ptr>::value>::type>
+        basic_iterator(basic_iterator<_R, _P> const& o) noexcept
+            : h_(o.h_)
+        {
+        }
+
+        reference operator*() const noexcept
+        {
+            return _Hook::element(*h_);
+        }
+
+        pointer operator->() const noexcept
+        {
+            return &_Hook::element(*h_);
+        }
+
+        basic_iterator& operator++() noexcept
+        {
+            h_ = Detail::treeIncrement(h_);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            h_ = Detail::treeIncrement(h_);
+            return tmp;
+        }
+
+        basic_iterator& operator--() noexcept
+        {
+            h_ = Detail::treeDecrement(h_);
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto tmp = *this;
+            h_ = Detail::treeDecrement(h_);
+            return tmp;
+        }
+
+        template <typename _R, typename _P>
+        bool operator==(basic_iterator<_R, _P> const& o) const noexcept
+        {
+            return h_ == o.h_;
+        }
+
+        template <typename _R, typename _P>
+        bool operator!=(basic_iterator<_R, _P> const& o) const noexcept
+        {
+            return h_ != o.h_;
+        }
+
+    private:
+        template <typename, typename> friend class basic_iterator;
+        friend class IntrusiveTree;
+
+        Hook* h_ = nullptr;
+    };
+
+    using iterator = basic_iterator<_Ty&, _Ty*>;
+    using const_iterator = basic_iterator<_Ty const&, _Ty const*>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    ~IntrusiveTree() noexcept
+    {
+        clear();
+    }
+
+    explicit IntrusiveTree(_Compare compare = _Compare(), _KeyOf keyOf = _KeyOf())
+        : m_compare(std::move(compare))
+        , m_keyOf(std::move(keyOf))
+    {
+        reset();
+    }
+
+    // the root and the first and last elements point back at the header
+    IntrusiveTree(const IntrusiveTree&) = delete;
+    IntrusiveTree& operator=(const IntrusiveTree&) = delete;
+
+    bool empty() const noexcept
+    {
+        return !m_size;
+    }
+
+    size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator(m_header.left);
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(m_header.left);
+    }
+
+    iterator end() noexcept
+    {
+        return iterator(&m_header);
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator(const_cast<Hook*>(&m_header));
+    }
+
+    reverse_iterator rbegin() noexcept
+    {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() noexcept
+    {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    // the position of an element known to be in this tree
+    static iterator iterator_to(_Ty& item) noexcept
+    {
+        return iterator(&_Hook::get(item));
+    }
+
+    static const_iterator iterator_to(_Ty const& item) noexcept
+    {
+        return const_iterator(&_Hook::get(const_cast<_Ty&>(item)));
+    }
+
+    // the smallest element
+    reference front()
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling front() on an empty tree");
+        return _Hook::element(*m_header.left);
+    }
+
+    const_reference front() const
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling front() on an empty tree");
+        return _Hook::element(*m_header.left);
+    }
+
+    // the largest element
+    reference back()
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling back() on an empty tree");
+        return _Hook::element(*m_header.right);
+    }
+
+    const_reference back() const
+    {
+        assert(!empty());
+        if (empty())
+            throw std::exception("Calling back() on an empty tree");
+        return _Hook::element(*m_header.right);
+    }
+
+    // in a set, the element already holding the key and false if there is one;
+    // in a multiset item goes after the elements with an equal key
+    std::pair<iterator, bool> insert(_Ty* item) noexcept
+    {
+        assert(item);
+
+        auto& h = _Hook::get(*item);
+        assert(!h.linked());
+
+        auto const& key = m_keyOf(*item);
+        auto p = &m_header;
+        auto x = m_header.parent;
+        bool left = true;
+        while (x)
+        {
+            p = x;
+            left = m_compare(key, keyOf(x));
+            x = left ? x->left : x->right;
+        }
+
+        if (_Unique)
+        {
+            // an equal key can only be the element before the insert position
+            auto prev = p;
+            if (left)
+                prev = (p == m_header.left) ? nullptr : Detail::treeDecrement(p);
+
+            if (prev && !m_compare(keyOf(prev), key))
+                return std::make_pair(iterator(prev), false);
+        }
+
+        Detail::treeInsert(left, &h, p, m_header);
+        ++m_size;
+
+        return std::make_pair(iterator(&h), true);
+    }
+
+    // item must be in this tree
+    void erase(_Ty* item) noexcept
+    {
+        assert(item);
+
+        auto& h = _Hook::get(*item);
+        assert(h.linked());
+
+        Detail::treeErase(&h, m_header);
+        h.parent = nullptr;
+        h.left = nullptr;
+        h.right = nullptr;
+        --m_size;
+    }
+
+    // returns the element after the erased one
+    iterator erase(const_iterator pos) noexcept
+    {
+        assert(pos.h_ != &m_header);
+
+        auto next = Detail::treeIncrement(pos.h_);
+        erase(&_Hook::element(*pos.h_));
+        return iterator(next);
+    }
+
+    // otherwise the erase(key) template would be the better match for an iterator
+    iterator erase(iterator pos) noexcept
+    {
+        return erase(const_iterator(pos));
+    }
+
+    iterator erase(const_iterator first, const_iterator last) noexcept
+    {
+        while (first != last)
+            first = erase(first);
+
+        return iterator(last.h_);
+    }
+
+    // the number of elements unlinked
+    template <typename _Key>
+    size_t erase(_Key const& key) noexcept
+    {
+        auto range = equal_range(key);
+
+        size_t n = 0;
+        for (auto i = range.first; i != range.second; ++n)
+            i = erase(i);
+
+        return n;
+    }
+
+    // unlinks and returns the smallest element, nullptr if empty
+    _Ty* pop_front() noexcept
+    {
+        if (empty())
+            return nullptr;
+
+        auto item = &_Hook::element(*m_header.left);
+        erase(item);
+        return item;
+    }
+
+    // unlinks everything in O(n) without rebalancing
+    void clear() noexcept
+    {
+        auto h = m_header.parent;
+        while (h)
+        {
+            if (h->left)
+            {
+                h = h->left;
+            }
+            else if (h->right)
+            {
+                h = h->right;
+            }
+            else
+            {
+                // a leaf: cut it off its parent and climb
+                auto p = h->parent;
+                if (p == &m_header)
+                    p = nullptr;
+                else if (p->left == h)
+                    p->left = nullptr;
+                else
+                    p->right = nullptr;
+
+                h->parent = nullptr;
+                h->red = false;
+                h = p;
+            }
+        }
+
+        reset();
+    }
+
+    template <typename _Key>
+    iterator find(_Key const& key) noexcept
+    {
+        auto i = lower_bound(key);
+        return (i == end() || m_compare(key, keyOf(i.h_))) ? end() : i;
+    }
+
+    template <typename _Key>
+    const_iterator find(_Key const& key) const noexcept
+    {
+        return const_cast<IntrusiveTree*>(this)->find(key);
+    }
+
+    template <typename _Key>
+    bool contains(_Key const& key) const noexcept
+    {
+        return find(key) != end();
+    }
+
+    template <typename _Key>
+    size_t count(_Key const& key) const noexcept
+    {
+        auto range = equal_range(key);
+        return size_t(std::distance(range.first, range.second));
+    }
+
+    // the first element whose key is not less than key
+    template <typename _Key>
+    iterator lower_bound(_Key const& key) noexcept
+    {
+        auto y = &m_header;
+        auto x = m_header.parent;
+        while (x)
+        {
+            if (!m_compare(keyOf(x), key))
+            {
+                y = x;
+                x = x->left;
+            }
+            else
+            {
+                x = x->right;
+            }
+        }
+
+        return iterator(y);
+    }
+
+    template <typename _Key>
+    const_iterator lower_bound(_Key const& key) const noexcept
+    {
+        return const_cast<IntrusiveTree*>(this)->lower_bound(key);
+    }
+
+    // the first element whose key is greater than key
+    template <typename _Key>
+    iterator upper_bound(_Key const& key) noexcept
+    {
+        auto y = &m_header;
+        auto x = m_header.parent;
+        while (x)
+        {
+            if (m_compare(key, keyOf(x)))
+            {
+                y = x;
+                x = x->left;
+            }
+            else
+            {
+                x = x->right;
+            }
+        }
+
+        return iterator(y);
+    }
+
+    template <typename _Key>
+    const_iterator upper_bound(_Key const& key) const noexcept
+    {
+        return const_cast<IntrusiveTree*>(this)->upper_bound(key);
+    }
+
+    template <typename _Key>
+    std::pair<iterator, iterator> equal_range(_Key const& key) noexcept
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    template <typename _Key>
+    std::pair<const_iterator, const_iterator> equal_range(_Key const& key) const noexcept
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+private:
+    decltype(auto) keyOf(Hook* h) const noexcept
+    {
+        return m_keyOf(_Hook::element(*h));
+    }
+
+    void reset() noexcept
+    {
+        m_header.parent = nullptr;
+        m_header.left = &m_header;
+        m_header.right = &m_header;
+        m_header.red = true;
+        m_size = 0;
+    }
+
+    Hook m_header;
+    size_t m_size = 0;
+    _Compare m_compare;
+    _KeyOf m_keyOf;
+};
+
+template <typename _Ty, typename _KeyOf, typename _Compare = std::less<>, typename _Hook = IntrusiveTreeBaseHook<_Ty>>
+using IntrusiveSet = IntrusiveTree<_Ty, _KeyOf, _Compare, _Hook, true>;
+
+template <typename _Ty, typename _KeyOf, typename _Compare = std::less<>, typename _Hook = IntrusiveTreeBaseHook<_Ty>>
+using IntrusiveMultiSet = IntrusiveTree<_Ty, _KeyOf, _Compare, _Hook, false>;
+
+
+} // namespace Util {}
@@ -0,0 +1,462 @@
+#pragma once
+
+#include "./IntrusiveHashTable.hxx"
+#include "./IntrusiveList.hxx"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+// a cache whose entries carry their own recency links and index link, so a hit
+// is a lookup plus two pointer swaps and an insert allocates nothing (beyond the
+// occasional index growth)
+//
+// segmented LRU: new entries start in the probation segment, a hit promotes them
+// to the protected segment, and when protected is over its share of the capacity
+// its oldest entry drops back to probation; eviction takes the oldest probation
+// entry first, so a scan of one-off keys can't flush the entries that get reused
+//
+// capacity is a total weight, every entry says what it weighs; the cache owns
+// its entries and hands evicted ones to the disposer
+
+
+namespace Util
+{
+
+// derive entries from this, e.g. struct Page : Util::LruCacheHook<Page> { ... }
+template <typename _Ty>
+struct LruCacheHook
+{
+    IntrusiveListHook<_Ty> lru;
+    IntrusiveHashHook index;
+    size_t weight = 0;
+    uint8_t segment = 0;
+};
+
+
+template <
+    typename _Ty,
+    typename _KeyOf,
+    typename _Disposer = IntrusiveDelete,
+    typename _Hash = MurmurHash<Detail::IntrusiveKeyType<_Ty, _KeyOf>>,
+    typename _Equal = std::equal_to<>
+    >
+class LruCache
+{
+public:
+    using key_type = Detail::IntrusiveKeyType<_Ty, _KeyOf>;
+    using value_type = _Ty;
+    using size_type = std::size_t;
+
+    using Hook = LruCacheHook<_Ty>;
+
+    // protectedShare is the part of the capacity hits may keep; 0 makes a plain LRU
+    explicit LruCache(size_t capacity, double protectedShare = 0.8, _Disposer disposer = _Disposer(), _KeyOf keyOf = _KeyOf(), _Hash hash = _Hash(), _Equal equal = _Equal())
+        : m_index(16, std::move(keyOf), std::move(hash), std::move(equal))
+        , m_disposer(std::move(disposer))
+    {
+        assert(protectedShare >= 0 && protectedShare <= 1);
+
+        m_protectedShare = protectedShare;
+        setCapacity(capacity);
+    }
+
+    ~LruCache() noexcept
+    {
+        clear();
+    }
+
+    LruCache(const LruCache&) = delete;
+    LruCache& operator=(const LruCache&) = delete;
+
+    bool empty() const noexcept
+    {
+        return m_index.empty();
+    }
+
+    size_t size() const noexcept
+    {
+        return m_index.size();
+    }
+
+    size_t weight() const noexcept
+    {
+        return m_weight;
+    }
+
+    size_t capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+    // evicts right away if the cache is over the new capacity
+    void setCapacity(size_t capacity) noexcept
+    {
+        m_capacity = capacity;
+        m_protectedCapacity = size_t(double(capacity) * m_protectedShare);
+
+        demote();
+        evict(nullptr);
+    }
+
+    // takes ownership of item; false, and item stays the caller's, if its key is
+    // already cached; evicts until the cache fits again, but never item itself, so
+    // an entry heavier than the whole capacity stays until the next insert
+    bool insert(_Ty* item, size_t weight = 1)
+    {
+        assert(item);
+
+        if (!m_index.insert(item))
+            return false;
+
+        auto& h = hook(item);
+        h.weight = weight;
+        h.segment = kProbation;
+        m_probation.push_front(item);
+        m_weight += weight;
+
+        evict(item);
+        return true;
+    }
+
+    // the cached entry, marked as just used, or nullptr
+    template <typename _Key>
+    _Ty* find(_Key const& key) noexcept
+    {
+        auto item = m_index.find(key);
+        if (item)
+            touch(item);
+
+        return item;
+    }
+
+    // like find() but leaves the recency order alone
+    template <typename _Key>
+    _Ty* peek(_Key const& key) const noexcept
+    {
+        return m_index.find(key);
+    }
+
+    template <typename _Key>
+    bool contains(_Key const& key) const noexcept
+    {
+        return m_index.contains(key);
+    }
+
+    // takes an entry of this cache out without disposing of it
+    _Ty* unlink(_Ty* item) noexcept
+    {
+        assert(item);
+
+        auto& h = hook(item);
+        assert(h.segment != kNone);
+
+        m_index.erase(item);
+        list(h.segment).unlink(item);
+        m_weight -= h.weight;
+        if (h.segment == kProtected)
+            m_protectedWeight -= h.weight;
+
+        h.segment = kNone;
+        return item;
+    }
+
+    void erase(_Ty* item) noexcept
+    {
+        m_disposer(unlink(item));
+    }
+
+    // false if the key isn't cached
+    template <typename _Key>
+    bool erase(_Key const& key) noexcept
+    {
+        auto item = m_index.find(key);
+        if (!item)
+            return false;
+
+        erase(item);
+        return true;
+    }
+
+    void clear() noexcept
+    {
+        m_index.clear();
+
+        for (auto segment : { &m_probation, &m_protected })
+        {
+            while (!segment->empty())
+            {
+                auto item = &segment->front();
+                segment->unlink(item);
+                hook(item).segment = kNone;
+                m_disposer(item);
+            }
+        }
+
+        m_weight = 0;
+        m_protectedWeight = 0;
+    }
+
+private:
+    enum : uint8_t
+    {
+        kNone,
+        kProbation,
+        kProtected
+    };
+
+    struct ListHook
+    {
+        static IntrusiveListHook<_Ty>& get(_Ty& v) noexcept
+        {
+            return static_cast<Hook&>(v).lru;
+        }
+    };
+
+    struct IndexHook
+    {
+        static IntrusiveHashHook& get(_Ty& v) noexcept
+        {
+            return static_cast<Hook&>(v).index;
+        }
+
+        static _Ty& element(IntrusiveHashHook& h) noexcept
+        {
+            return static_cast<_Ty&>(Detail::intrusiveElement(h, &Hook::index));
+        }
+    };
+
+    using Segment = IntrusiveList<_Ty, ListHook, IntrusiveNoDispose>;
+    using Index = IntrusiveHashTable<_Ty, _KeyOf, _Hash, IndexHook, _Equal>;
+
+    static Hook& hook(_Ty* item) noexcept
+    {
+        return static_cast<Hook&>(*item);
+    }
+
+    Segment& list(uint8_t segment) noexcept
+    {
+        return (segment == kProtected) ? m_protected : m_probation;
+    }
+
+    void touch(_Ty* item) noexcept
+    {
+        auto& h = hook(item);
+        if (h.segment == kProtected || m_protectedCapacity == 0)
+        {
+            auto& segment = list(h.segment);
+            if (&segment.front() != item)
+            {
+                segment.unlink(item);
+                segment.push_front(item);
+            }
+
+            return;
+        }
+
+        m_probation.unlink(item);
+        m_protected.push_front(item);
+        h.segment = kProtected;
+        m_protectedWeight += h.weight;
+
+        demote();
+    }
+
+    // moves the oldest protected entries back to probation, keeping the newest one
+    void demote() noexcept
+    {
+        while (m_protectedWeight > m_protectedCapacity && m_protected.size() > 1)
+        {
+            auto item = &m_protected.back();
+            m_protected.unlink(item);
+            m_probation.push_front(item);
+
+            auto& h = hook(item);
+            h.segment = kProbation;
+            m_protectedWeight -= h.weight;
+        }
+    }
+
+    void evict(_Ty* keep) noexcept
+    {
+        while (m_weight > m_capacity)
+        {
+            auto item = !m_probation.empty() ? &m_probation.back() : nullptr;
+            if (!item || item == keep)
+            {
+                // keep is the only probation entry left; take the oldest protected one
+                item = !m_protected.empty() ? &m_protected.back() : nullptr;
+                if (!item)
+                    break;
+            }
+
+            erase(item);
+        }
+    }
+
+    Index m_index;
+    Segment m_probation;            // newest first
+    Segment m_protected;            // newest first
+    size_t m_weight = 0;
+    size_t m_protectedWeight = 0;
+    size_t m_capacity = 0;
+    size_t m_protectedCapacity = 0;
+    double m_protectedShare = 0;
+    _Disposer m_disposer;
+};
+
+
+// LruCache split into independently locked shards picked by key hash, so
+// threads working on different keys rarely meet on a lock; capacity is divided
+// evenly, shares differing by at most one, so a shard evicts on its own when its
+// share is full and the total never exceeds capacity (a capacity below the shard
+// count leaves some shards with none)
+//
+// entries are only reachable under their shard's lock: find() hands the entry
+// to a callback instead of returning it, and the disposer runs under the lock
+template <
+    typename _Ty,
+    typename _KeyOf,
+    typename _Disposer = IntrusiveDelete,
+    typename _Hash = MurmurHash<Detail::IntrusiveKeyType<_Ty, _KeyOf>>,
+    typename _Equal = std::equal_to<>,
+    typename _Lock = std::mutex
+    >
+class ShardedLruCache
+{
+public:
+    using Cache = LruCache<_Ty, _KeyOf, _Disposer, _Hash, _Equal>;
+
+    // shards is rounded up to a power of two
+    ShardedLruCache(size_t capacity, size_t shards, double protectedShare = 0.8, _Disposer disposer = _Disposer(), _KeyOf keyOf = _KeyOf(), _Hash hash = _Hash(), _Equal equal = _Equal())
+        : m_keyOf(std::move(keyOf))
+        , m_hash(std::move(hash))
+    {
+        size_t n = 1;
+        while (n < shards)
+        {
+            n *= 2;
+            ++m_shardBits;
+        }
+
+        // one allocation each keeps the locks of neighbouring shards off a
+        // shared cache line
+        m_shards.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            m_shards.emplace_back(new Shard(capacity / n + (i < capacity % n), protectedShare, disposer, m_keyOf, m_hash, equal));
+    }
+
+    ShardedLruCache(const ShardedLruCache&) = delete;
+    ShardedLruCache& operator=(const ShardedLruCache&) = delete;
+
+    size_t shardCount() const noexcept
+    {
+        return m_shards.size();
+    }
+
+    // takes each shard's lock in turn, so only a snapshot under concurrent use
+    size_t size() const
+    {
+        size_t n = 0;
+        for (auto& s : m_shards)
+        {
+            std::lock_guard<_Lock> g(s->lock);
+            n += s->cache.size();
+        }
+
+        return n;
+    }
+
+    size_t weight() const
+    {
+        size_t n = 0;
+        for (auto& s : m_shards)
+        {
+            std::lock_guard<_Lock> g(s->lock);
+            n += s->cache.weight();
+        }
+
+        return n;
+    }
+
+    // see LruCache::insert()
+    bool insert(_Ty* item, size_t weight = 1)
+    {
+        assert(item);
+
+        auto& s = shard(m_keyOf(*item));
+        std::lock_guard<_Lock> g(s.lock);
+        return s.cache.insert(item, weight);
+    }
+
+    // fn(_Ty&) on the cached entry, under the shard lock; false on a miss
+    template <typename _Key, typename _Fn>
+    bool find(_Key const& key, _Fn fn)
+    {
+        auto& s = shard(key);
+        std::lock_guard<_Lock> g(s.lock);
+
+        auto item = s.cache.find(key);
+        if (!item)
+            return false;
+
+        fn(*item);
+        return true;
+    }
+
+    template <typename _Key>
+    bool erase(_Key const& key)
+    {
+        auto& s = shard(key);
+        std::lock_guard<_Lock> g(s.lock);
+        return s.cache.erase(key);
+    }
+
+    void clear()
+    {
+        for (auto& s : m_shards)
+        {
+            std::lock_guard<_Lock> g(s->lock);
+            s->cache.clear();
+        }
+    }
+
+private:
+    struct Shard
+    {
+        Shard(size_t capacity, double protectedShare, _Disposer const& disposer, _KeyOf const& keyOf, _Hash const& hash, _Equal const& equal)
+            : cache(capacity, protectedShare, disposer, keyOf, hash, equal)
+        {
+        }
+
+        mutable _Lock lock;
+        Cache cache;
+    };
+
+    // the index inside a shard buckets by the low bits of the same hash, which
+    // may be only 32 bits wide; a Fibonacci multiply folds all of them into the
+    // high bits that pick the shard
+    template <typename _Key>
+    Shard& shard(_Key const& key) const noexcept
+    {
+        if (!m_shardBits)
+            return *m_shards[0];
+
+        auto h = uint64_t(m_hash(key)) * 0x9e3779b97f4a7c15ULL;
+        return *m_shards[size_t(h >> (64 - m_shardBits))];
+    }
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    unsigned m_shardBits = 0;
+    _KeyOf m_keyOf;
+    _Hash m_hash;
+};
+
+
+} // namespace Util {}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <memory>
 #include <string>
@@ -8,35 +9,126 @@
 #include <vector>
 
 #include <windows.h>
+#include <psapi.h>
 
 //#define PERFTIMER_ENABLED
+//#define PERFTIMER_COUNTERS
+
+
+class PerformanceSampler;
+class PerformanceToken;
+
+
+//
+// per-scope CPU counters; Windows gives user mode no access to the PMU, so
+// cache misses, stalls and retired instructions can't be had here; all that
+// is reported is thread cycles, thread CPU time and process-wide page faults
+//
+// the thread cycle counter counts stall cycles too and runs at a constant
+// rate, so cycles per CPU second is just the clock rate and says nothing
+// about memory-bound code; for that, sample PMCs with ETW (xperf -pmc)
+//
+// CpuTime ticks at the scheduler quantum (~15.6 ms), short scopes only show
+// noise in it; and Read() is three syscalls, which an enabled scope makes on
+// entry and again on exit
+//
+
+struct PerformanceCounters
+{
+	uint64_t Cycles;      // thread cycle counter (QueryThreadCycleTime)
+	uint64_t CpuTime;     // thread user + kernel time, 100 ns units
+	uint64_t PageFaults;  // process-wide, includes soft faults
+
+	PerformanceCounters() noexcept
+		: Cycles(0)
+		, CpuTime(0)
+		, PageFaults(0)
+	{
+	}
+
+	static PerformanceCounters Read() noexcept
+	{
+		PerformanceCounters c;
+
+		ULONG64 Cycles = 0;
+		if (::QueryThreadCycleTime(::GetCurrentThread(), &Cycles))
+			c.Cycles = Cycles;
+
+		FILETIME Creation, Exit, Kernel, User;
+		if (::GetThreadTimes(::GetCurrentThread(), &Creation, &Exit, &Kernel, &User))
+		{
+			c.CpuTime = ToUInt64(Kernel) + ToUInt64(User);
+		}
+
+		PROCESS_MEMORY_COUNTERS Mem;
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), &Mem, sizeof(Mem)))
+			c.PageFaults = Mem.PageFaultCount;
+
+		return c;
+	}
+
+	PerformanceCounters& operator+=(PerformanceCounters const &o) noexcept
+	{
+		Cycles += o.Cycles;
+		CpuTime += o.CpuTime;
+		PageFaults += o.PageFaults;
+		return *this;
+	}
+
+	PerformanceCounters operator-(PerformanceCounters const &o) const noexcept
+	{
+		PerformanceCounters c;
+		c.Cycles = Cycles - o.Cycles;
+		c.CpuTime = CpuTime - o.CpuTime;
+		c.PageFaults = PageFaults - o.PageFaults;
+		return c;
+	}
+
+private:
+	static uint64_t ToUInt64(FILETIME const &ft) noexcept
+	{
+		return (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+	}
+};
 
 
 class PerformanceTimer
 {
+	friend class PerformanceSampler;
+	friend class PerformanceToken;
+
 public:
 	~PerformanceTimer()
 	{
+		if (!m_What)
+			return;
+
+		PopActive();
+
 		LARGE_INTEGER Finished;
 		::QueryPerformanceCounter(&Finished);
 		auto Delta = Finished.QuadPart - m_Started.QuadPart;
+#ifdef PERFTIMER_COUNTERS
+		auto Counters = PerformanceCounters::Read() - m_Counters;
+#endif
 
-		auto It = Items().find(m_Id);
-		assert(It != Items().end());
-		auto& w = It->second;
+		auto& w = *m_What;
 
 		PopPrev();
+
+		if (m_Root)
+			--SubtreeDepth();
 		
 		w.Duration += Delta;
 		++w.Count;
+#ifdef PERFTIMER_COUNTERS
+		w.Counters += Counters;
+#endif
 
 		--Ref();
 
 		if (Ref() == 0)
 		{
-			LARGE_INTEGER Freq;
-			::QueryPerformanceFrequency(&Freq);
-
 			auto& Ite = Items();
 			std::vector<What> Sorted;
 			Sorted.reserve(Items().size());
@@ -46,63 +138,260 @@ public:
 			}
 			Ite.clear();
 
-			std::sort(Sorted.begin(), Sorted.end(), [](What const &a, What const &b) { return a.FullId < b.FullId; });
+			TakeAsync(Sorted);
 
-			OutputDebugStringW(L"---------------------------------------------------------------------------------------------->\n");
-			for (auto const &w : Sorted)
-			{
-				std::wstring s;
-				s.append(L"[");
-				s.append(w.FullId);
-				s.append(L"] ");
-				
-				auto Diff = w.Duration / double(Freq.QuadPart);
-
-				wchar_t Tmp[64];
-				::swprintf_s(Tmp, _countof(Tmp), L"%llu  %.3f", w.Count, Diff);
-				s.append(Tmp);
-				s.append(L" sec\n");
+			auto SampleTotal = SampleCount().exchange(0);
 
-				::OutputDebugStringW(s.c_str());
-			}
-			OutputDebugStringW(L"<----------------------------------------------------------------------------------------------\n");
+			Print(Sorted, SampleTotal);
 		}
 	}
 
+	// a disabled scope costs one relaxed load and a branch; the name is not even copied
+	PerformanceTimer(const wchar_t* Id)
+		: m_What(nullptr)
+		, m_Root(false)
+	{
+		if (IsEnabled(Id))
+			Start(Id);
+	}
+
 	PerformanceTimer(std::wstring const &Id)
-		: m_Id(MakeId(Id))
+		: m_What(nullptr)
+		, m_Root(false)
+	{
+		if (IsEnabled(Id.c_str()))
+			Start(Id);
+	}
+
+	PerformanceTimer(PerformanceTimer const&) = delete;
+	PerformanceTimer& operator=(PerformanceTimer const&) = delete;
+
+	//
+	// runtime switch; scopes already running are finished as they were started
+	//
+
+	static void Enable() noexcept
+	{
+		State().store(ModeAll, std::memory_order_relaxed);
+	}
+
+	static void Disable() noexcept
+	{
+		State().store(ModeOff, std::memory_order_relaxed);
+	}
+
+	static bool Enabled() noexcept
 	{
+		return State().load(std::memory_order_relaxed) == ModeAll;
+	}
+
+	// PerformanceToken results are otherwise printed with the next scope report
+	static void FlushAsync()
+	{
+		std::vector<What> Sorted;
+		TakeAsync(Sorted);
+
+		if (!Sorted.empty())
+			Print(Sorted, 0);
+	}
+
+	// time only scopes named Id and everything nested in them; switches off global mode
+	static void EnableSubtree(std::wstring const &Id)
+	{
+		::AcquireSRWLockExclusive(&SubtreeLock());
+
+		auto& r = Subtrees();
+		if (std::find(r.begin(), r.end(), Id) == r.end())
+			r.push_back(Id);
+
+		State().store(ModeSubtrees, std::memory_order_relaxed);
+
+		::ReleaseSRWLockExclusive(&SubtreeLock());
+	}
+
+	static void DisableSubtree(std::wstring const &Id)
+	{
+		::AcquireSRWLockExclusive(&SubtreeLock());
+
+		auto& r = Subtrees();
+		r.erase(std::remove(r.begin(), r.end(), Id), r.end());
+
+		if (r.empty())
+		{
+			long Expected = ModeSubtrees;
+			State().compare_exchange_strong(Expected, ModeOff, std::memory_order_relaxed);
+		}
+
+		::ReleaseSRWLockExclusive(&SubtreeLock());
+	}
+
+private:
+	enum Mode : long
+	{
+		ModeOff,
+		ModeAll,
+		ModeSubtrees
+	};
+
+	static std::atomic<long>& State()
+	{
+		static std::atomic<long> _State(ModeAll);
+		return _State;
+	}
+
+	bool IsEnabled(const wchar_t* Id)
+	{
+		auto m = State().load(std::memory_order_relaxed);
+		if (m == ModeOff)
+			return false;
+
+		if (m == ModeAll)
+			return true;
+
+		return IsInSubtree(Id);
+	}
+
+	bool IsInSubtree(const wchar_t* Id)
+	{
+		if (SubtreeDepth() > 0)
+			return true;
+
+		m_Root = IsSubtreeRoot(Id);
+		return m_Root;
+	}
+
+	static bool IsSubtreeRoot(const wchar_t* Id)
+	{
+		bool Found = false;
+
+		::AcquireSRWLockShared(&SubtreeLock());
+
+		for (auto const &r : Subtrees())
+		{
+			if (r == Id)
+			{
+				Found = true;
+				break;
+			}
+		}
+
+		::ReleaseSRWLockShared(&SubtreeLock());
+
+		return Found;
+	}
+
+	void Start(std::wstring const &Id)
+	{
+		if (m_Root)
+			++SubtreeDepth();
+
 		++Ref();
 
+		auto FullId = MakeId(Id);
 		SetPrev(Id);
 
-		auto It = Items().find(m_Id);
+		auto It = Items().find(FullId);
 		if (It == Items().end())
 		{
-			Items().insert(std::make_pair(m_Id, What(Id, m_Id)));
+			It = Items().insert(std::make_pair(FullId, What(Id, FullId))).first;
 		}
 
+		m_What = &It->second;
+		PushActive(m_What);
+
+#ifdef PERFTIMER_COUNTERS
+		m_Counters = PerformanceCounters::Read();
+#endif
 		::QueryPerformanceCounter(&m_Started);
 	}
 
 
-private:
 	struct What
 	{
 		std::wstring Id;
 		std::wstring FullId;
 		long long Duration;
 		uint64_t Count;
+		PerformanceCounters Counters;
+		uint64_t Samples;      // sampler ticks while this scope was on the stack
+		uint64_t SelfSamples;  // sampler ticks while this scope was innermost
+		uint64_t Hops;         // PerformanceToken only: thread switches between stages
 
 		What(std::wstring const &Id, std::wstring const &FullId)
 			: Id(Id)
 			, FullId(FullId)
 			, Duration(0)
 			, Count(0)
+			, Samples(0)
+			, SelfSamples(0)
+			, Hops(0)
 		{
 		}
 	};
 
+	//
+	// the scope stack as seen by PerformanceSampler; it is read while the
+	// owning thread is suspended, so it must be updated with plain stores only,
+	// no locks, no allocations; What entries are node-based and never move
+	//
+
+	enum { MaxActiveDepth = 64 };
+
+	struct ActiveStack
+	{
+		What* volatile Items[MaxActiveDepth];
+		volatile long Depth;
+	};
+
+	static ActiveStack& Active()
+	{
+		static ActiveStack _Active = {};
+		return _Active;
+	}
+
+	static void PushActive(What* w)
+	{
+		auto& a = Active();
+		auto Depth = a.Depth;
+		if (Depth < MaxActiveDepth)
+			a.Items[Depth] = w;
+
+		_WriteBarrier();
+		a.Depth = Depth + 1;
+	}
+
+	static void PopActive()
+	{
+		auto& a = Active();
+		a.Depth = a.Depth - 1;
+	}
+
+	// bumped by the sampler thread, taken and reset by the owner in one step
+	static std::atomic<uint64_t>& SampleCount()
+	{
+		static std::atomic<uint64_t> _Count(0);
+		return _Count;
+	}
+
+	// called by the sampler with the owning thread suspended
+	static void Sample()
+	{
+		auto& a = Active();
+		long Depth = a.Depth;
+		SampleCount().fetch_add(1, std::memory_order_relaxed);
+
+		if (Depth <= 0)
+			return;
+
+		if (Depth > MaxActiveDepth)
+			Depth = MaxActiveDepth;
+
+		for (long i = 0; i < Depth; ++i)
+			++a.Items[i]->Samples;
+
+		++a.Items[Depth - 1]->SelfSamples;
+	}
+
 	typedef std::unordered_map<std::wstring, What> TItems;
 
 	static long& Ref()
@@ -111,6 +400,77 @@ private:
 		return _Ref;
 	}
 
+	static long& SubtreeDepth()
+	{
+		static long _Depth = 0;
+		return _Depth;
+	}
+
+	static std::vector<std::wstring>& Subtrees()
+	{
+		static std::vector<std::wstring> _Subtrees;
+		return _Subtrees;
+	}
+
+	static SRWLOCK& SubtreeLock()
+	{
+		static SRWLOCK _Lock = SRWLOCK_INIT;
+		return _Lock;
+	}
+
+	//
+	// PerformanceToken results; unlike the scope data these come from any thread
+	//
+
+	struct AsyncItems
+	{
+		SRWLOCK Lock;
+		TItems Items;
+
+		AsyncItems()
+		{
+			::InitializeSRWLock(&Lock);
+		}
+	};
+
+	static AsyncItems& Async()
+	{
+		static AsyncItems _Async;
+		return _Async;
+	}
+
+	static void AddAsync(std::wstring const &FullId, long long Duration, uint64_t Hops)
+	{
+		auto& a = Async();
+		::AcquireSRWLockExclusive(&a.Lock);
+
+		auto It = a.Items.find(FullId);
+		if (It == a.Items.end())
+		{
+			It = a.Items.insert(std::make_pair(FullId, What(FullId, FullId))).first;
+		}
+
+		It->second.Duration += Duration;
+		++It->second.Count;
+		It->second.Hops += Hops;
+
+		::ReleaseSRWLockExclusive(&a.Lock);
+	}
+
+	static void TakeAsync(std::vector<What>& Out)
+	{
+		auto& a = Async();
+		::AcquireSRWLockExclusive(&a.Lock);
+
+		for (auto const &w : a.Items)
+		{
+			Out.push_back(w.second);
+		}
+		a.Items.clear();
+
+		::ReleaseSRWLockExclusive(&a.Lock);
+	}
+
 	static TItems& Items()
 	{
 		static TItems _Items;
@@ -133,6 +493,64 @@ private:
 		return Id;
 	}
 
+	static void Print(std::vector<What>& Sorted, uint64_t SampleTotal)
+	{
+		LARGE_INTEGER Freq;
+		::QueryPerformanceFrequency(&Freq);
+
+		std::sort(Sorted.begin(), Sorted.end(), [](What const &a, What const &b) { return a.FullId < b.FullId; });
+
+		OutputDebugStringW(L"---------------------------------------------------------------------------------------------->\n");
+		for (auto const &w : Sorted)
+		{
+			std::wstring s;
+			s.append(L"[");
+			s.append(w.FullId);
+			s.append(L"] ");
+			
+			auto Diff = w.Duration / double(Freq.QuadPart);
+
+			wchar_t Tmp[128];
+			::swprintf_s(Tmp, _countof(Tmp), L"%llu  %.3f", w.Count, Diff);
+			s.append(Tmp);
+			s.append(L" sec");
+			if (w.Hops)
+			{
+				::swprintf_s(Tmp, _countof(Tmp), L"  %llu thread hops", w.Hops);
+				s.append(Tmp);
+			}
+			if (SampleTotal)
+			{
+				::swprintf_s(
+					Tmp,
+					_countof(Tmp),
+					L"  %llu/%llu smp  %.1f%% self  %.1f%% total",
+					w.SelfSamples,
+					w.Samples,
+					100.0 * w.SelfSamples / SampleTotal,
+					100.0 * w.Samples / SampleTotal
+					);
+				s.append(Tmp);
+			}
+#ifdef PERFTIMER_COUNTERS
+			// CPU time well below wall time means we were blocked
+			::swprintf_s(
+				Tmp,
+				_countof(Tmp),
+				L"  %.3f cpu  %llu cyc  %llu pf",
+				w.Counters.CpuTime / 10000000.0,
+				w.Counters.Cycles,
+				w.Counters.PageFaults
+				);
+			s.append(Tmp);
+#endif
+			s.append(L"\n");
+
+			::OutputDebugStringW(s.c_str());
+		}
+		OutputDebugStringW(L"<----------------------------------------------------------------------------------------------\n");
+	}
+
 	static void PopPrev()
 	{
 		auto& s = Stack();
@@ -166,15 +584,246 @@ private:
 		return w;
 	}
 	
-	std::wstring m_Id;
+	What* m_What;
+	bool m_Root;
 	LARGE_INTEGER m_Started;
+#ifdef PERFTIMER_COUNTERS
+	PerformanceCounters m_Counters;
+#endif
+};
+
+
+//
+// statistical attribution of time to PERFTIMER_SCOPEs: a timer queue callback
+// periodically suspends the thread that created the sampler, snapshots its
+// scope stack and resumes it; scopes get sample counts in the regular report
+//
+// the default timer resolution is ~15.6 ms; call timeBeginPeriod(1) for finer sampling
+//
+
+class PerformanceSampler
+{
+public:
+	~PerformanceSampler()
+	{
+		if (m_Timer)
+			::DeleteTimerQueueTimer(nullptr, m_Timer, INVALID_HANDLE_VALUE); // waits for a callback in progress
+
+		if (m_Thread)
+			::CloseHandle(m_Thread);
+	}
+
+	explicit PerformanceSampler(DWORD IntervalMs = 1)
+		: m_Thread(nullptr)
+		, m_Timer(nullptr)
+	{
+		if (!::DuplicateHandle(
+			::GetCurrentProcess(),
+			::GetCurrentThread(),
+			::GetCurrentProcess(),
+			&m_Thread,
+			THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION,
+			FALSE,
+			0
+			))
+		{
+			m_Thread = nullptr;
+			return;
+		}
+
+		if (!::CreateTimerQueueTimer(&m_Timer, nullptr, Tick, this, IntervalMs, IntervalMs, WT_EXECUTEINTIMERTHREAD))
+			m_Timer = nullptr;
+	}
+
+	PerformanceSampler(PerformanceSampler const&) = delete;
+	PerformanceSampler& operator=(PerformanceSampler const&) = delete;
+
+private:
+	static VOID CALLBACK Tick(PVOID Param, BOOLEAN)
+	{
+		auto _this = static_cast<PerformanceSampler*>(Param);
+
+		if (::SuspendThread(_this->m_Thread) == DWORD(-1))
+			return;
+
+		// SuspendThread() is asynchronous; GetThreadContext() waits until the thread is actually stopped
+		CONTEXT Context;
+		Context.ContextFlags = CONTEXT_CONTROL;
+		if (::GetThreadContext(_this->m_Thread, &Context))
+			PerformanceTimer::Sample();
+
+		::ResumeThread(_this->m_Thread);
+	}
+
+	HANDLE m_Thread;
+	HANDLE m_Timer;
 };
 
+
+
+//
+// times a logical operation that is carried across threads, e.g. moved along with
+// a queued task and finished on another thread; Stage() closes the current stage
+// and opens the next one, Finish() or the destructor closes the operation
+//
+// results appear in the PerformanceTimer report as [@Operation] and [@Operation/Stage]
+//
+
+class PerformanceToken
+{
+public:
+	~PerformanceToken()
+	{
+		Drop();
+	}
+
+	PerformanceToken() noexcept
+		: m_Tid(0)
+		, m_Hops(0)
+		, m_Active(false)
+	{
+	}
+
+	explicit PerformanceToken(const wchar_t* Operation, const wchar_t* FirstStage = nullptr)
+		: m_Tid(0)
+		, m_Hops(0)
+		, m_Active(false)
+	{
+		auto m = PerformanceTimer::State().load(std::memory_order_relaxed);
+		if (m == PerformanceTimer::ModeOff)
+			return;
+
+		if ((m == PerformanceTimer::ModeSubtrees) && !PerformanceTimer::IsSubtreeRoot(Operation))
+			return;
+
+		m_Operation.assign(L"@");
+		m_Operation.append(Operation);
+		if (FirstStage)
+			m_Stage.assign(FirstStage);
+
+		m_Tid = ::GetCurrentThreadId();
+		m_Active = true;
+
+		::QueryPerformanceCounter(&m_Started);
+		m_StageStarted = m_Started;
+	}
+
+	PerformanceToken(PerformanceToken const&) = delete;
+	PerformanceToken& operator=(PerformanceToken const&) = delete;
+
+	void swap(PerformanceToken& o) noexcept
+	{
+		using std::swap;
+		m_Operation.swap(o.m_Operation);
+		m_Stage.swap(o.m_Stage);
+		swap(m_Started, o.m_Started);
+		swap(m_StageStarted, o.m_StageStarted);
+		swap(m_Tid, o.m_Tid);
+		swap(m_Hops, o.m_Hops);
+		swap(m_Active, o.m_Active);
+	}
+
+	PerformanceToken(PerformanceToken&& o) noexcept
+		: PerformanceToken()
+	{
+		o.swap(*this);
+	}
+
+	PerformanceToken& operator=(PerformanceToken&& o) noexcept
+	{
+		if (this != &o)
+		{
+			Drop();
+			PerformanceToken(std::move(o)).swap(*this);
+		}
+
+		return *this;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_Active;
+	}
+
+	void Stage(const wchar_t* Name)
+	{
+		if (!m_Active)
+			return;
+
+		LARGE_INTEGER Now;
+		::QueryPerformanceCounter(&Now);
+
+		CloseStage(Now);
+
+		m_Stage.assign(Name);
+		m_StageStarted = Now;
+	}
+
+	void Finish()
+	{
+		if (!m_Active)
+			return;
+
+		LARGE_INTEGER Now;
+		::QueryPerformanceCounter(&Now);
+
+		CloseStage(Now);
+
+		PerformanceTimer::AddAsync(m_Operation, Now.QuadPart - m_Started.QuadPart, m_Hops);
+		m_Active = false;
+	}
+
+private:
+	// Finish() for the noexcept paths: reporting allocates, and an operation
+	// that can't be reported is lost rather than taking the process down
+	void Drop() noexcept
+	{
+		try
+		{
+			Finish();
+		}
+		catch (...)
+		{
+			m_Active = false;
+		}
+	}
+
+	void CloseStage(LARGE_INTEGER Now)
+	{
+		auto Tid = ::GetCurrentThreadId();
+		if (Tid != m_Tid)
+		{
+			++m_Hops;
+			m_Tid = Tid;
+		}
+
+		if (!m_Stage.empty())
+		{
+			PerformanceTimer::AddAsync(m_Operation + L"/" + m_Stage, Now.QuadPart - m_StageStarted.QuadPart, 0);
+		}
+	}
+
+	std::wstring m_Operation;
+	std::wstring m_Stage;
+	LARGE_INTEGER m_Started;
+	LARGE_INTEGER m_StageStarted;
+	DWORD m_Tid;
+	uint64_t m_Hops;
+	bool m_Active;
+};
+
+
 #ifdef PERFTIMER_ENABLED
 #define PERFTIMER_SCOPE(Name)     PerformanceTimer __PerfTimer__ ## __LINE__(L ## Name)
 #define PERFTIMER_SCOPEW(Name)    PerformanceTimer __PerfTimer__ ## __LINE__(Name)
+#define PERFTIMER_SAMPLER(IntervalMs) PerformanceSampler __PerfSampler__ ## __LINE__(IntervalMs)
+#define PERFTIMER_TOKEN(Name)     PerformanceToken(L ## Name)
+#define PERFTIMER_TOKENW(Name)    PerformanceToken((Name).c_str())
 #else
 #define PERFTIMER_SCOPE(Name)     (void)0
 #define PERFTIMER_SCOPEW(Name)    (void)0
+#define PERFTIMER_SAMPLER(IntervalMs) (void)0
+#define PERFTIMER_TOKEN(Name)     PerformanceToken()
+#define PERFTIMER_TOKENW(Name)    PerformanceToken()
 #endif
 
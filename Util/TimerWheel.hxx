@@ -0,0 +1,345 @@
+#pragma once
+
+#include "./IntrusiveCircularList.hxx"
+#include "./IntrusiveList.hxx"
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <intrin.h>
+
+
+// hierarchical timer wheel (Varghese, Lauck): 4 levels of 64 slots, each slot
+// an intrusive list, level n slots spanning 64^n ticks, so one wheel covers
+// 64^4 ticks (4.6 hours at 1 ms) and timers further out wait in the last level
+// until they come into range
+//
+// schedule() and cancel() are O(1) and never allocate; a timer is placed by how
+// far away it is and moves down one level whenever the level below wraps onto
+// its slot (cascading), so it is touched at most once per level before it fires
+//
+// a bitmap per level marks the slots in use, so advance() jumps straight to the
+// next tick with work instead of walking empty slots, and an idle wheel costs
+// nothing however much time passes
+//
+// the wheel counts abstract ticks; drive it with monotonicMilliseconds() or any
+// other clock that never goes back
+
+
+namespace Util
+{
+
+// milliseconds since an arbitrary start, never affected by wall clock changes
+inline uint64_t monotonicMilliseconds() noexcept
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+struct TimerWheelHook
+{
+    TimerWheelHook() = default;
+
+    // copies start unlinked, see IntrusiveListHook
+    TimerWheelHook(const TimerWheelHook&) noexcept
+    {
+    }
+
+    TimerWheelHook& operator=(const TimerWheelHook&) noexcept
+    {
+        return *this;
+    }
+
+    bool scheduled() const noexcept
+    {
+        return link.linked();
+    }
+
+    IntrusiveCircularHook link;
+    uint64_t expires = 0;
+    uint8_t level = 0;
+    uint8_t slot = 0;
+};
+
+template <typename _Ty>
+using TimerWheelBaseHook = Detail::IntrusiveBaseHookTraits<_Ty, TimerWheelHook>;
+
+template <typename _Ty, TimerWheelHook _Ty::* _Member>
+using TimerWheelMemberHook = Detail::IntrusiveMemberHookTraits<_Ty, TimerWheelHook, _Member>;
+
+
+namespace Detail
+{
+
+// index of the lowest set bit of w != 0; two 32 bit scans so x86 builds work too
+inline unsigned wheelLowestBit(uint64_t w) noexcept
+{
+    unsigned long i;
+    if (_BitScanForward(&i, static_cast<unsigned long>(w)))
+        return unsigned(i);
+
+    _BitScanForward(&i, static_cast<unsigned long>(w >> 32));
+    return 32 + unsigned(i);
+}
+
+} // namespace Detail {}
+
+
+template <typename _Ty, typename _Hook = TimerWheelBaseHook<_Ty>>
+class TimerWheel
+{
+public:
+    using Hook = TimerWheelHook;
+
+    static const unsigned kLevels = 4;
+    static const unsigned kSlotBits = 6;
+    static const unsigned kSlots = 1u << kSlotBits;
+
+    // further out than this a timer parks in the last level and is placed again
+    // once that slot comes round
+    static const uint64_t kRange = uint64_t(1) << (kLevels * kSlotBits);
+
+    explicit TimerWheel(uint64_t now = 0) noexcept
+        : m_now(now)
+    {
+    }
+
+    ~TimerWheel() noexcept
+    {
+        clear();
+    }
+
+    // the slot lists point back at sentinels inside the wheel
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    uint64_t now() const noexcept
+    {
+        return m_now;
+    }
+
+    bool empty() const noexcept
+    {
+        return !m_size;
+    }
+
+    size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    static bool scheduled(_Ty const& timer) noexcept
+    {
+        return _Hook::get(const_cast<_Ty&>(timer)).scheduled();
+    }
+
+    // fires at the first advance() to expires or later, at the earliest on the
+    // next tick; a scheduled timer is moved
+    void schedule(_Ty* timer, uint64_t expires) noexcept
+    {
+        assert(timer);
+
+        auto& h = _Hook::get(*timer);
+        if (h.scheduled())
+            unlink(h);
+        else
+            ++m_size;
+
+        h.expires = (expires > m_now) ? expires : m_now + 1;
+        place(h);
+    }
+
+    void scheduleAfter(_Ty* timer, uint64_t ticks) noexcept
+    {
+        schedule(timer, m_now + ticks);
+    }
+
+    // false if the timer wasn't scheduled
+    bool cancel(_Ty* timer) noexcept
+    {
+        assert(timer);
+
+        auto& h = _Hook::get(*timer);
+        if (!h.scheduled())
+            return false;
+
+        unlink(h);
+        --m_size;
+        return true;
+    }
+
+    // the tick at which advance() next has something to do, a cascade or an
+    // expiry; UINT64_MAX when empty; a loop can sleep until then
+    uint64_t nextEvent() const noexcept
+    {
+        if (!m_size)
+            return UINT64_MAX;
+
+        uint64_t next = UINT64_MAX;
+        for (unsigned level = 0; level < kLevels; ++level)
+        {
+            auto occupied = m_occupied[level];
+            if (!occupied)
+                continue;
+
+            // level 0 slots come round every tick, level n slots on multiples of 64^n
+            auto shift = level * kSlotBits;
+            auto base = ((m_now >> shift) + 1) << shift;
+            auto index = unsigned(base >> shift) & (kSlots - 1);
+
+            auto rotated = (occupied >> index) | (index ? occupied << (kSlots - index) : 0);
+            auto t = base + (uint64_t(Detail::wheelLowestBit(rotated)) << shift);
+            if (t < next)
+                next = t;
+        }
+
+        return next;
+    }
+
+    // moves the wheel to now, calling fn(_Ty&) for every timer that expired on
+    // the way, earliest first; fn may schedule or cancel any timer but must not
+    // throw; returns the number of timers fired
+    template <typename _Fn>
+    size_t advance(uint64_t now, _Fn fn)
+    {
+        size_t fired = 0;
+        while (m_now < now)
+        {
+            auto t = nextEvent();
+            if (t > now)
+            {
+                m_now = now;
+                break;
+            }
+
+            m_now = t;
+
+            // higher levels first, what they cascade may land in a lower slot due now
+            for (unsigned level = kLevels - 1; level > 0; --level)
+            {
+                auto shift = level * kSlotBits;
+                if (t & ((uint64_t(1) << shift) - 1))
+                    continue;
+
+                cascade(level, unsigned(t >> shift) & (kSlots - 1));
+            }
+
+            fired += expire(unsigned(t) & (kSlots - 1), fn);
+        }
+
+        return fired;
+    }
+
+    // unschedules everything without firing it
+    void clear() noexcept
+    {
+        for (auto& level : m_slots)
+        {
+            for (auto& slot : level)
+            {
+                while (!slot.empty())
+                    slot.unlink(&slot.front());
+            }
+        }
+
+        for (auto& occupied : m_occupied)
+            occupied = 0;
+
+        m_size = 0;
+    }
+
+private:
+    struct SlotHook
+    {
+        static IntrusiveCircularHook& get(_Ty& v) noexcept
+        {
+            return _Hook::get(v).link;
+        }
+
+        static _Ty& element(IntrusiveCircularHook& h) noexcept
+        {
+            return _Hook::element(Detail::intrusiveElement(h, &Hook::link));
+        }
+    };
+
+    using Slot = IntrusiveCircularList<_Ty, SlotHook, IntrusiveNoDispose>;
+
+    // by distance: level n holds timers less than 64^(n + 1) ticks away, in the
+    // slot of their expiry at that level's granularity, which comes round before
+    // they are due; due ones go to the current level 0 slot
+    void place(Hook& h) noexcept
+    {
+        auto delta = (h.expires > m_now) ? h.expires - m_now : 0;
+        auto expires = (delta < kRange) ? h.expires : m_now + kRange - 1;
+
+        unsigned level = 0;
+        while (level + 1 < kLevels && delta >= (uint64_t(1) << ((level + 1) * kSlotBits)))
+            ++level;
+
+        auto slot = unsigned(expires >> (level * kSlotBits)) & (kSlots - 1);
+        h.level = uint8_t(level);
+        h.slot = uint8_t(slot);
+
+        m_slots[level][slot].push_back(&_Hook::element(h));
+        m_occupied[level] |= uint64_t(1) << slot;
+    }
+
+    void unlink(Hook& h) noexcept
+    {
+        auto& slot = m_slots[h.level][h.slot];
+        h.link.unlink();
+        if (slot.empty())
+            m_occupied[h.level] &= ~(uint64_t(1) << h.slot);
+    }
+
+    void cascade(unsigned level, unsigned index) noexcept
+    {
+        auto& slot = m_slots[level][index];
+        if (slot.empty())
+            return;
+
+        Slot moving;
+        moving.splice(moving.end(), slot);
+        m_occupied[level] &= ~(uint64_t(1) << index);
+
+        while (!moving.empty())
+        {
+            auto timer = moving.unlink(&moving.front());
+            place(_Hook::get(*timer));
+        }
+    }
+
+    template <typename _Fn>
+    size_t expire(unsigned index, _Fn& fn)
+    {
+        auto& slot = m_slots[0][index];
+        if (slot.empty())
+            return 0;
+
+        // taken out first so fn can schedule into this very slot
+        Slot due;
+        due.splice(due.end(), slot);
+        m_occupied[0] &= ~(uint64_t(1) << index);
+
+        size_t fired = 0;
+        while (!due.empty())
+        {
+            auto timer = due.unlink(&due.front());
+            --m_size;
+            ++fired;
+            fn(*timer);
+        }
+
+        return fired;
+    }
+
+    Slot m_slots[kLevels][kSlots];
+    uint64_t m_occupied[kLevels] = {};
+    uint64_t m_now;
+    size_t m_size = 0;
+};
+
+
+} // namespace Util {}
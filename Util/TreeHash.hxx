@@ -0,0 +1,189 @@
+#pragma once
+
+#include "./murmurhash.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+
+
+// tree mode of murmurHash3_128 for large buffers and files: the input is cut
+// into fixed-size chunks, the chunks are hashed in parallel and the root is
+// murmurHash3_128 over the chunk digests, the total length and the chunk size
+//
+// the result depends on the chunk size but not on the number of threads; it
+// differs from murmurHash3_128 over the same bytes
+
+
+namespace Util
+{
+
+const size_t kTreeHashChunk = size_t(1) << 20;
+
+namespace Detail
+{
+
+inline size_t treeHashChunks(uint64_t len, size_t chunkSize) noexcept
+{
+    return size_t((len + chunkSize - 1) / chunkSize);
+}
+
+// digests[i] covers data[i * chunkSize, (i + 1) * chunkSize); workers take
+// chunks off a shared counter so a slow core doesn't hold up the rest
+inline void treeHashLeaves(const uint8_t* data, size_t len, size_t chunkSize, uint32_t seed, Hash128* digests, unsigned threads)
+{
+    auto count = treeHashChunks(len, chunkSize);
+    std::atomic<size_t> next(0);
+
+    auto work = [&]()
+    {
+        for (;;)
+        {
+            auto i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= count)
+                break;
+
+            auto offset = i * chunkSize;
+            digests[i] = murmurHash3_128(data + offset, std::min(chunkSize, len - offset), seed);
+        }
+    };
+
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    threads = unsigned(std::min<size_t>(threads, count));
+
+    // the calling thread is one of the workers; the vector must not throw once
+    // threads are running, they would be destroyed joinable
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    try
+    {
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back(work);
+    }
+    catch (std::system_error const&)
+    {
+        // fewer workers; the counter hands their chunks to the others
+    }
+
+    work();
+
+    for (auto& w : workers)
+        w.join();
+}
+
+inline Hash128 treeHashRoot(std::vector<Hash128>& digests, uint64_t len, size_t chunkSize, uint32_t seed)
+{
+    // the trailer keeps inputs that split into the same digests apart
+    digests.push_back(Hash128{ len, uint64_t(chunkSize) });
+    auto root = murmurHash3_128(digests.data(), digests.size() * sizeof(Hash128), seed);
+    digests.pop_back();
+
+    return root;
+}
+
+// closing must not clobber the error being reported
+struct TreeHashClose
+{
+    void operator()(HANDLE h) const noexcept
+    {
+        auto error = ::GetLastError();
+        ::CloseHandle(h);
+        ::SetLastError(error);
+    }
+};
+
+struct TreeHashUnmap
+{
+    void operator()(const void* view) const noexcept
+    {
+        auto error = ::GetLastError();
+        ::UnmapViewOfFile(view);
+        ::SetLastError(error);
+    }
+};
+
+using TreeHashHandle = std::unique_ptr<void, TreeHashClose>;
+
+} // namespace Detail {}
+
+
+// threads = 0 uses every core; chunkSize must not be 0
+inline Hash128 murmurHash3Tree(const void* data, size_t len, uint32_t seed, size_t chunkSize = kTreeHashChunk, unsigned threads = 0)
+{
+    assert(chunkSize);
+    chunkSize = std::max<size_t>(chunkSize, 1);
+
+    std::vector<Hash128> digests(Detail::treeHashChunks(len, chunkSize));
+    Detail::treeHashLeaves(static_cast<const uint8_t*>(data), len, chunkSize, seed, digests.data(), threads);
+
+    return Detail::treeHashRoot(digests, len, chunkSize, seed);
+}
+
+// same result as murmurHash3Tree() over the file contents; the file is mapped a
+// window at a time, so it may be larger than the address space; returns false
+// and leaves GetLastError() set if the file can't be opened or mapped
+inline bool murmurHash3TreeFile(const wchar_t* path, Hash128& result, uint32_t seed, size_t chunkSize = kTreeHashChunk, unsigned threads = 0)
+{
+    assert(chunkSize);
+    chunkSize = std::max<size_t>(chunkSize, 1);
+
+    Detail::TreeHashHandle file(::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+    if (file.get() == INVALID_HANDLE_VALUE)
+    {
+        file.release();
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file.get(), &size))
+        return false;
+
+    uint64_t len = uint64_t(size.QuadPart);
+    std::vector<Hash128> digests(Detail::treeHashChunks(len, chunkSize));
+
+    // an empty file can't be mapped
+    Detail::TreeHashHandle mapping;
+    if (len)
+    {
+        mapping.reset(::CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+        if (!mapping)
+            return false;
+    }
+
+    SYSTEM_INFO si;
+    ::GetSystemInfo(&si);
+
+    // whole chunks per window
+    const uint64_t kWindow = (sizeof(void*) > 4) ? (uint64_t(1) << 30) : (uint64_t(1) << 26);
+    auto window = std::max<uint64_t>(1, kWindow / chunkSize) * chunkSize;
+
+    for (uint64_t offset = 0; offset < len; offset += window)
+    {
+        auto bytes = size_t(std::min(window, len - offset));
+
+        // views start on the allocation granularity, chunks need not
+        auto base = offset - offset % si.dwAllocationGranularity;
+        auto skip = size_t(offset - base);
+
+        std::unique_ptr<const void, Detail::TreeHashUnmap> view(::MapViewOfFile(mapping.get(), FILE_MAP_READ, DWORD(base >> 32), DWORD(base), skip + bytes));
+        if (!view)
+            return false;
+
+        Detail::treeHashLeaves(static_cast<const uint8_t*>(view.get()) + skip, bytes, chunkSize, seed, digests.data() + offset / chunkSize, threads);
+    }
+
+    result = Detail::treeHashRoot(digests, len, chunkSize, seed);
+    return true;
+}
+
+} // namespace Util {}
@@ -1,82 +1,558 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
 
 
 // MurmurHash3 by Austin Appleby
 
 
+// the x86_32 helpers are constexpr so string literals can be hashed at compile time
+#if defined(__clang__)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define UTIL_HAS_IS_CONSTANT_EVALUATED 1
+#endif
+#elif (defined(_MSC_VER) && (_MSC_VER >= 1925)) || (defined(__GNUC__) && (__GNUC__ >= 9))
+#define UTIL_HAS_IS_CONSTANT_EVALUATED 1
+#endif
+
+// blocks are read as little endian everywhere, so hashes can be stored and compared across machines
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define UTIL_BIG_ENDIAN 1
+#endif
+
+
 namespace Util
 {
 
-inline uint32_t rot32(uint32_t x, int8_t r)
+constexpr uint32_t rot32(uint32_t x, int8_t r)
 {
     return (x << r) | (x >> (32 - r));
 }
 
-inline uint32_t murmurHash3(const void *key, int32_t len, uint32_t seed)
+inline uint64_t rot64(uint64_t x, int8_t r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+constexpr uint32_t fmix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+struct Hash128
+{
+    uint64_t h1;
+    uint64_t h2;
+};
+
+
+namespace Detail
+{
+
+// the round, tail and finalization steps are shared by the one-shot
+// functions and the streaming hashers so both produce identical results
+
+// memcpy loads are safe at any alignment and compile to a single mov
+inline uint32_t murmurLoad32(const uint8_t* p) noexcept
+{
+    uint32_t k;
+    ::memcpy(&k, p, sizeof(k));
+#if defined(UTIL_BIG_ENDIAN)
+    k = __builtin_bswap32(k);
+#endif
+    return k;
+}
+
+inline uint64_t murmurLoad64(const uint8_t* p) noexcept
+{
+    uint64_t k;
+    ::memcpy(&k, p, sizeof(k));
+#if defined(UTIL_BIG_ENDIAN)
+    k = __builtin_bswap64(k);
+#endif
+    return k;
+}
+
+const uint32_t kMurmur32C1 = 0xcc9e2d51;
+const uint32_t kMurmur32C2 = 0x1b873593;
+
+const uint64_t kMurmur128C1 = 0x87c37b91114253d5ULL;
+const uint64_t kMurmur128C2 = 0x4cf5ad432745937fULL;
+
+constexpr uint32_t murmur32Round(uint32_t h1, uint32_t k1)
+{
+    k1 *= kMurmur32C1;
+    k1 = rot32(k1, 15);
+    k1 *= kMurmur32C2;
+
+    h1 ^= k1;
+    h1 = rot32(h1, 13);
+    h1 = h1 * 5 + 0xe6546b64;
+
+    return h1;
+}
+
+// k1 is the raw tail word, 0 when len is a multiple of 4
+constexpr uint32_t murmur32Tail(uint32_t h1, uint32_t k1, size_t len)
+{
+    k1 *= kMurmur32C1;
+    k1 = rot32(k1, 15);
+    k1 *= kMurmur32C2;
+    h1 ^= k1;
+
+    h1 ^= uint32_t(len);
+
+    return fmix32(h1);
+}
+
+inline uint32_t murmur32Finish(uint32_t h1, const uint8_t* tail, size_t len)
+{
+    uint32_t k1 = 0;
+
+    switch (len & 3)
+    {
+    case 3:
+        k1 ^= tail[2] << 16;
+    case 2:
+        k1 ^= tail[1] << 8;
+    case 1:
+        k1 ^= tail[0];
+    };
+
+    return murmur32Tail(h1, k1, len);
+}
+
+// byte i of a character string as laid out in memory
+template <typename _Char>
+constexpr uint32_t murmurStringByte(const _Char* s, size_t i)
+{
+    using Unsigned = typename std::make_unsigned<_Char>::type;
+#if defined(UTIL_BIG_ENDIAN)
+    return uint8_t(Unsigned(s[i / sizeof(_Char)]) >> ((sizeof(_Char) - 1 - i % sizeof(_Char)) * 8));
+#else
+    return uint8_t(Unsigned(s[i / sizeof(_Char)]) >> ((i % sizeof(_Char)) * 8));
+#endif
+}
+
+inline void murmur128Round(uint64_t& h1, uint64_t& h2, uint64_t k1, uint64_t k2)
+{
+    k1 *= kMurmur128C1;
+    k1 = rot64(k1, 31);
+    k1 *= kMurmur128C2;
+    h1 ^= k1;
+
+    h1 = rot64(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= kMurmur128C2;
+    k2 = rot64(k2, 33);
+    k2 *= kMurmur128C1;
+    h2 ^= k2;
+
+    h2 = rot64(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+}
+
+inline Hash128 murmur128Finish(uint64_t h1, uint64_t h2, const uint8_t* tail, size_t len)
+{
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+
+    switch (len & 15)
+    {
+    case 15:
+        k2 ^= uint64_t(tail[14]) << 48;
+    case 14:
+        k2 ^= uint64_t(tail[13]) << 40;
+    case 13:
+        k2 ^= uint64_t(tail[12]) << 32;
+    case 12:
+        k2 ^= uint64_t(tail[11]) << 24;
+    case 11:
+        k2 ^= uint64_t(tail[10]) << 16;
+    case 10:
+        k2 ^= uint64_t(tail[9]) << 8;
+    case 9:
+        k2 ^= uint64_t(tail[8]);
+        k2 *= kMurmur128C2;
+        k2 = rot64(k2, 33);
+        k2 *= kMurmur128C1;
+        h2 ^= k2;
+    case 8:
+        k1 ^= uint64_t(tail[7]) << 56;
+    case 7:
+        k1 ^= uint64_t(tail[6]) << 48;
+    case 6:
+        k1 ^= uint64_t(tail[5]) << 40;
+    case 5:
+        k1 ^= uint64_t(tail[4]) << 32;
+    case 4:
+        k1 ^= uint64_t(tail[3]) << 24;
+    case 3:
+        k1 ^= uint64_t(tail[2]) << 16;
+    case 2:
+        k1 ^= uint64_t(tail[1]) << 8;
+    case 1:
+        k1 ^= uint64_t(tail[0]);
+        k1 *= kMurmur128C1;
+        k1 = rot64(k1, 31);
+        k1 *= kMurmur128C2;
+        h1 ^= k1;
+    };
+
+    h1 ^= uint64_t(len);
+    h2 ^= uint64_t(len);
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    return Hash128{ h1, h2 };
+}
+
+} // namespace Detail {}
+
+
+// x86_32 variant
+inline uint32_t murmurHash3(const void *key, size_t len, uint32_t seed)
 {
     const uint8_t * data = (const uint8_t*)key;
-    const int nblocks = len / 4;
+    const uint8_t * end = data + (len & ~size_t(3));
+
+    uint32_t h1 = seed;
+
+    // body
+    for (; data != end; data += 4)
+    {
+        h1 = Detail::murmur32Round(h1, Detail::murmurLoad32(data));
+    }
+
+    // tail & finalization
+    return Detail::murmur32Finish(h1, end, len);
+}
+
+// same value as murmurHash3(s, count * sizeof(_Char), seed) but usable in
+// constant expressions, i.e. case labels or constexpr variables; byte-wise
+// loads are only used at compile time
+template <typename _Char>
+constexpr uint32_t murmurHash3String(const _Char* s, size_t count, uint32_t seed = 0)
+{
+#if defined(UTIL_HAS_IS_CONSTANT_EVALUATED)
+    if (!__builtin_is_constant_evaluated())
+        return murmurHash3(s, count * sizeof(_Char), seed);
+#endif
+
+    const size_t len = count * sizeof(_Char);
+    const size_t nblocks = len / 4;
 
     uint32_t h1 = seed;
 
-    const uint32_t c1 = 0xcc9e2d51;
-    const uint32_t c2 = 0x1b873593;
+    // body
+    for (size_t i = 0; i < nblocks * 4; i += 4)
+    {
+        uint32_t k1 = Detail::murmurStringByte(s, i)
+            | (Detail::murmurStringByte(s, i + 1) << 8)
+            | (Detail::murmurStringByte(s, i + 2) << 16)
+            | (Detail::murmurStringByte(s, i + 3) << 24);
+
+        h1 = Detail::murmur32Round(h1, k1);
+    }
+
+    // tail & finalization
+    uint32_t k1 = 0;
+    auto tail = nblocks * 4;
+
+    switch (len & 3)
+    {
+    case 3:
+        k1 ^= Detail::murmurStringByte(s, tail + 2) << 16;
+    case 2:
+        k1 ^= Detail::murmurStringByte(s, tail + 1) << 8;
+    case 1:
+        k1 ^= Detail::murmurStringByte(s, tail);
+    };
+
+    return Detail::murmur32Tail(h1, k1, len);
+}
+
+// x64_128 variant; 16 bytes per round, meant for 64-bit targets
+inline Hash128 murmurHash3_128(const void *key, size_t len, uint32_t seed)
+{
+    const uint8_t * data = (const uint8_t*)key;
+    const size_t nblocks = len / 16;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
 
     // body
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        auto block = data + i * 16;
+        Detail::murmur128Round(h1, h2, Detail::murmurLoad64(block), Detail::murmurLoad64(block + 8));
+    }
+
+    // tail & finalization
+    return Detail::murmur128Finish(h1, h2, data + nblocks * 16, len);
+}
+
+// x64_128 folded to 64 bits
+inline uint64_t murmurHash3_64(const void *key, size_t len, uint32_t seed)
+{
+    auto h = murmurHash3_128(key, len, seed);
+    return h.h1 ^ h.h2;
+}
+
+
+//
+// incremental hashers for keys that arrive in pieces; any split of
+// the input gives the same result as the one-shot function
+//
+
+class MurmurHash3Stream
+{
+public:
+    explicit MurmurHash3Stream(uint32_t seed = 0) noexcept
     {
-        auto blocks = (const uint32_t*)(data + nblocks * 4);
-        int i;
-        for (i = -nblocks; i; i++)
+        reset(seed);
+    }
+
+    void reset(uint32_t seed = 0) noexcept
+    {
+        m_h1 = seed;
+        m_len = 0;
+        m_pending = 0;
+    }
+
+    void update(const void *data, size_t len) noexcept
+    {
+        auto p = (const uint8_t*)data;
+        m_len += len;
+
+        // complete a block left over from the previous call
+        if (m_pending)
         {
-            uint32_t k1 = blocks[i];
+            while (m_pending < sizeof(m_buffer) && len)
+            {
+                m_buffer[m_pending++] = *p++;
+                --len;
+            }
 
-            k1 *= c1;
-            k1 = rot32(k1, 15);
-            k1 *= c2;
+            if (m_pending < sizeof(m_buffer))
+                return;
 
-            h1 ^= k1;
-            h1 = rot32(h1, 13);
-            h1 = h1 * 5 + 0xe6546b64;
+            m_h1 = Detail::murmur32Round(m_h1, Detail::murmurLoad32(m_buffer));
+            m_pending = 0;
         }
+
+        while (len >= sizeof(m_buffer))
+        {
+            m_h1 = Detail::murmur32Round(m_h1, Detail::murmurLoad32(p));
+            p += sizeof(m_buffer);
+            len -= sizeof(m_buffer);
+        }
+
+        while (len--)
+        {
+            m_buffer[m_pending++] = *p++;
+        }
+    }
+
+    // does not change the state, so more data can follow
+    uint32_t finalize() const noexcept
+    {
+        return Detail::murmur32Finish(m_h1, m_buffer, m_len);
+    }
+
+private:
+    uint32_t m_h1;
+    size_t m_len;
+    size_t m_pending;
+    uint8_t m_buffer[4];
+};
+
+class MurmurHash3Stream128
+{
+public:
+    explicit MurmurHash3Stream128(uint32_t seed = 0) noexcept
+    {
+        reset(seed);
+    }
+
+    void reset(uint32_t seed = 0) noexcept
+    {
+        m_h1 = seed;
+        m_h2 = seed;
+        m_len = 0;
+        m_pending = 0;
     }
 
-    // tail
+    void update(const void *data, size_t len) noexcept
     {
-        auto tail = (const uint8_t*)(data + nblocks * 4);
+        auto p = (const uint8_t*)data;
+        m_len += len;
+
+        // complete a block left over from the previous call
+        if (m_pending)
+        {
+            while (m_pending < sizeof(m_buffer) && len)
+            {
+                m_buffer[m_pending++] = *p++;
+                --len;
+            }
+
+            if (m_pending < sizeof(m_buffer))
+                return;
 
-        uint32_t k1 = 0;
+            round(m_buffer);
+            m_pending = 0;
+        }
 
-        switch (len & 3)
+        while (len >= sizeof(m_buffer))
         {
-        case 3:
-            k1 ^= tail[2] << 16;
-        case 2:
-            k1 ^= tail[1] << 8;
-        case 1:
-            k1 ^= tail[0];
-            k1 *= c1;
-            k1 = rot32(k1, 15);
-            k1 *= c2;
-            h1 ^= k1;
-        };
+            round(p);
+            p += sizeof(m_buffer);
+            len -= sizeof(m_buffer);
+        }
+
+        while (len--)
+        {
+            m_buffer[m_pending++] = *p++;
+        }
     }
 
-    // finalization
+    // does not change the state, so more data can follow
+    Hash128 finalize() const noexcept
+    {
+        return Detail::murmur128Finish(m_h1, m_h2, m_buffer, m_len);
+    }
 
-    h1 ^= len;
+    uint64_t finalize64() const noexcept
+    {
+        auto h = finalize();
+        return h.h1 ^ h.h2;
+    }
 
+private:
+    void round(const uint8_t* p) noexcept
     {
-        h1 ^= h1 >> 16;
-        h1 *= 0x85ebca6b;
-        h1 ^= h1 >> 13;
-        h1 *= 0xc2b2ae35;
-        h1 ^= h1 >> 16;
+        Detail::murmur128Round(m_h1, m_h2, Detail::murmurLoad64(p), Detail::murmurLoad64(p + 8));
     }
 
-    return h1;
+    uint64_t m_h1;
+    uint64_t m_h2;
+    size_t m_len;
+    size_t m_pending;
+    uint8_t m_buffer[16];
+};
+
+
+//
+// hash functor for containers; scalar keys hash their bytes, strings their characters
+//
+
+template <typename _Key>
+struct MurmurHash
+{
+    static_assert(std::is_scalar<_Key>::value, "MurmurHash<> needs a specialization for this key type");
+
+    size_t operator()(_Key const& key) const noexcept
+    {
+        return murmurHash3(&key, sizeof(key), 0);
+    }
+};
+
+// transparent, so containers keyed by std::string can be searched with a const char*
+template <typename _Char, typename _Traits, typename _Alloc>
+struct MurmurHash<std::basic_string<_Char, _Traits, _Alloc>>
+{
+    using is_transparent = void;
+
+    size_t operator()(std::basic_string<_Char, _Traits, _Alloc> const& key) const noexcept
+    {
+        return murmurHash3(key.data(), key.size() * sizeof(_Char), 0);
+    }
+
+    size_t operator()(const _Char* key) const noexcept
+    {
+        return murmurHash3(key, _Traits::length(key) * sizeof(_Char), 0);
+    }
+};
+
+
+namespace Detail
+{
+
+// murmurHash3_128 of a key for the probabilistic containers; scalars hash their
+// bytes, strings their characters (not the pointer)
+template <typename _Key>
+inline Hash128 murmurKey128(_Key const& key, uint32_t seed) noexcept
+{
+    static_assert(std::is_scalar<_Key>::value, "hash the key bytes with the (data, len) overloads");
+    return murmurHash3_128(&key, sizeof(key), seed);
+}
+
+template <typename _Char, typename _Traits, typename _Alloc>
+inline Hash128 murmurKey128(std::basic_string<_Char, _Traits, _Alloc> const& key, uint32_t seed) noexcept
+{
+    return murmurHash3_128(key.data(), key.size() * sizeof(_Char), seed);
+}
+
+inline Hash128 murmurKey128(const char* key, uint32_t seed) noexcept
+{
+    return murmurHash3_128(key, std::char_traits<char>::length(key), seed);
+}
+
+inline Hash128 murmurKey128(const wchar_t* key, uint32_t seed) noexcept
+{
+    return murmurHash3_128(key, std::char_traits<wchar_t>::length(key) * sizeof(wchar_t), seed);
 }
 
+} // namespace Detail {}
+
+
+namespace Literals
+{
+
+// "name"_mh3 is murmurHash3String("name") with seed 0
+constexpr uint32_t operator"" _mh3(const char* s, size_t count)
+{
+    return murmurHash3String(s, count);
+}
+
+constexpr uint32_t operator"" _mh3(const wchar_t* s, size_t count)
+{
+    return murmurHash3String(s, count);
+}
+
+} // namespace Literals {}
+
 
 } // namespace Util {}
@@ -1,7 +1,29 @@
+#include "../../Util/BloomFilter.hxx"
+#include "../../Util/ConsistentHash.hxx"
+#include "../../Util/CountMinSketch.hxx"
+#include "../../Util/FlatHashMap.hxx"
+#include "../../Util/HyperLogLog.hxx"
+#include "../../Util/IntrusiveCircularList.hxx"
+#include "../../Util/IntrusiveHashTable.hxx"
 #include "../../Util/IntrusiveList.hxx"
+#include "../../Util/IntrusiveMpscQueue.hxx"
+#include "../../Util/IntrusiveStack.hxx"
+#include "../../Util/IntrusiveTree.hxx"
+#include "../../Util/LruCache.hxx"
+#include "../../Util/TimerWheel.hxx"
+#include "../../Util/TreeHash.hxx"
+#include "../../Util/murmurhash.hxx"
+#include "../../Util/murmurhash_batch.hxx"
 #include "../../Core/Trace.hxx"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <crtdbg.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 struct Doll
     : public Util::IntrusiveList<Doll>::Node
@@ -25,6 +47,904 @@ struct Doll
     int i = 0;
 };
 
+// one object in two lists at once, neither of which deletes it
+struct Pooled
+{
+    int i = 0;
+    Util::IntrusiveListHook<Pooled> ready;
+    Util::IntrusiveListHook<Pooled> all;
+};
+
+
+// reference values from the canonical MurmurHash3_x86_32
+static_assert(Util::murmurHash3String("hello", 5) == 0x248bfa47, "constexpr murmurHash3String");
+static_assert(Util::murmurHash3String("", 0, 1) == 0x514e28b7, "constexpr murmurHash3String");
+
+// reference values from the canonical MurmurHash3_x64_128
+static bool testMurmurHash128()
+{
+    auto hello = Util::murmurHash3_128("hello", 5, 0);
+    if (hello.h1 != 0xcbd8a7b341bd9b02ULL || hello.h2 != 0x5b1e906a48ae1d19ULL)
+        return false;
+
+    const char fox[] = "The quick brown fox jumps over the lazy dog";
+    auto h = Util::murmurHash3_128(fox, sizeof(fox) - 1, 0);
+    if (h.h1 != 0xe34bbc7bbc071b6cULL || h.h2 != 0x7a433ca9c49a9347ULL)
+        return false;
+
+    return Util::murmurHash3_64(fox, sizeof(fox) - 1, 0) == (h.h1 ^ h.h2);
+}
+
+// the streaming hashers must match the one-shot functions for any split of the input
+static bool testMurmurHashStream()
+{
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(1000);
+    for (auto& b : data)
+        b = uint8_t(rng());
+
+    for (int round = 0; round < 1000; ++round)
+    {
+        auto len = rng() % data.size();
+        auto seed = uint32_t(rng());
+
+        Util::MurmurHash3Stream s32(seed);
+        Util::MurmurHash3Stream128 s128(seed);
+        for (size_t at = 0; at < len; )
+        {
+            // mostly pieces shorter than a block, sometimes several blocks at once
+            auto piece = std::min<size_t>(len - at, (rng() % 4) ? rng() % 17 : rng() % 100);
+            s32.update(data.data() + at, piece);
+            s128.update(data.data() + at, piece);
+            at += piece;
+        }
+
+        auto h = Util::murmurHash3_128(data.data(), len, seed);
+        auto h128 = s128.finalize();
+        if (s32.finalize() != Util::murmurHash3(data.data(), len, seed) ||
+            h128.h1 != h.h1 || h128.h2 != h.h2 ||
+            s128.finalize64() != Util::murmurHash3_64(data.data(), len, seed))
+            return false;
+    }
+
+    return true;
+}
+
+// every level the CPU has must give what murmurHash3 gives: counts that leave
+// partial groups, lengths either side of where the lanes take over, lengths
+// mixed within a group, keys off alignment and the strided overload
+static bool testMurmurHashBatch()
+{
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(64 * 1024);
+    for (auto& b : data)
+        b = uint8_t(rng());
+
+    const size_t kEdges[] = { 0, 1, 3, 4, 5, 15, 16, 17, 31, 32, 33, 63, 64, 65 };
+
+    const void* keys[300];
+    size_t lens[300];
+    uint32_t out[300];
+    for (auto level = Util::SimdLevel::Scalar; level <= Util::murmurHash3BatchLevel(); level = Util::SimdLevel(int(level) + 1))
+    {
+        for (int round = 0; round < 500; ++round)
+        {
+            auto count = size_t(rng() % 300);
+            auto seed = uint32_t(rng());
+            auto mode = round % 3;
+            for (size_t i = 0; i < count; ++i)
+            {
+                // all one length, mostly one length with a few odd ones, or anything
+                if (mode == 0)
+                    lens[i] = (i ? lens[0] : kEdges[rng() % _countof(kEdges)]);
+                else if (mode == 1)
+                    lens[i] = ((i && (rng() % 8)) ? lens[0] : kEdges[rng() % _countof(kEdges)]);
+                else
+                    lens[i] = rng() % 301;
+
+                keys[i] = data.data() + rng() % (data.size() - lens[i]);
+            }
+
+            Util::murmurHash3Batch(keys, lens, count, seed, out, level);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (out[i] != Util::murmurHash3(keys[i], lens[i], seed))
+                    return false;
+            }
+
+            auto len = kEdges[rng() % _countof(kEdges)] + rng() % 3;
+            auto stride = len + rng() % 8;
+            auto first = data.data() + rng() % 7;
+            Util::murmurHash3Batch(first, len, stride, count, seed, out, level);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (out[i] != Util::murmurHash3(first + i * stride, len, seed))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// the tree hash doesn't depend on the thread count, and hashing a file gives
+// the same as hashing its contents in memory
+static bool testTreeHash()
+{
+    const size_t kChunk = 4096;
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(100 * kChunk + 123);
+    for (auto& b : data)
+        b = uint8_t(rng());
+
+    auto expected = Util::murmurHash3Tree(data.data(), data.size(), 7, kChunk, 1);
+    for (unsigned threads : { 2u, 7u, 0u })
+    {
+        auto h = Util::murmurHash3Tree(data.data(), data.size(), 7, kChunk, threads);
+        if (h.h1 != expected.h1 || h.h2 != expected.h2)
+            return false;
+    }
+
+    wchar_t dir[MAX_PATH], path[MAX_PATH];
+    if (!::GetTempPathW(_countof(dir), dir) || !::GetTempFileNameW(dir, L"th", 0, path))
+        return false;
+
+    auto file = ::CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD written = 0;
+    auto ok = ::WriteFile(file, data.data(), DWORD(data.size()), &written, nullptr) && (written == data.size());
+    ::CloseHandle(file);
+
+    Util::Hash128 h = {};
+    ok = ok && Util::murmurHash3TreeFile(path, h, 7, kChunk);
+    ::DeleteFileW(path);
+
+    return ok && h.h1 == expected.h1 && h.h2 == expected.h2;
+}
+
+// erase leaves tombstones or empties depending on the group; reinsertion must find everything again
+static bool testFlatHashMap()
+{
+    Util::FlatHashMap<std::string, int> m;
+    for (int i = 0; i < 1000; ++i)
+        m[std::to_string(i)] = i;
+
+    for (int i = 0; i < 1000; i += 2)
+        m.erase(std::to_string(i));
+
+    for (int i = 0; i < 1000; i += 4)
+        m[std::to_string(i)] = i;
+
+    size_t visited = 0;
+    for (auto const& e : m)
+    {
+        if (std::to_string(e.second) != e.first)
+            return false;
+        ++visited;
+    }
+
+    // heterogeneous lookup
+    if (visited != 750 || m.size() != 750 || !m.contains("3") || m.contains("2") || m.find("8")->second != 8)
+        return false;
+
+    // erasing while iterating, through a mutable iterator
+    for (auto it = m.begin(); it != m.end(); )
+    {
+        if (it->second % 3)
+            it = m.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto const& e : m)
+    {
+        if (e.second % 3)
+            return false;
+    }
+
+    return (m.size() == 251) && m.contains("3") && !m.contains("1");
+}
+
+
+// no false negatives, also after erasing other keys from the counting filter,
+// and no more false positives than asked for
+static bool testBloomFilter()
+{
+    Util::BloomFilter f(10000, 0.01);
+    Util::CountingBloomFilter c(10000, 0.01);
+    for (int i = 0; i < 10000; ++i)
+    {
+        f.insert(i);
+        c.insert(i);
+    }
+
+    for (int i = 0; i < 10000; i += 2)
+        c.erase(i);
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        if (!f.mayContain(i) || ((i & 1) && !c.mayContain(i)))
+            return false;
+    }
+
+    // false positives near the target, also at a rate where the uneven load of
+    // the blocks matters; the slack covers sampling noise
+    for (double p : { 0.01, 0.0001 })
+    {
+        Util::BloomFilter g(100000, p);
+        for (int i = 0; i < 100000; ++i)
+            g.insert(i);
+
+        const int kQueries = 2000000;
+        int hits = 0;
+        for (int i = 0; i < kQueries; ++i)
+            hits += g.mayContain(100000 + i);
+
+        if (hits > kQueries * p * 1.3)
+            return false;
+    }
+
+    return true;
+}
+
+static bool testSketches()
+{
+    Util::HyperLogLog a, b;
+    Util::CountMinSketch c(0.001, 0.01), d(0.001, 0.01);
+    for (int i = 0; i < 100000; ++i)
+    {
+        (i & 1 ? a : b).add(i);
+        (i & 1 ? c : d).add(i % 1000);
+    }
+
+    if (!a.merge(b) || !c.merge(d))
+        return false;
+
+    auto n = a.estimate();
+    if (n < 97000 || n > 103000)
+        return false;
+
+    // a few hundred keys stay sparse, with some still pending at estimate()
+    Util::HyperLogLog s, t;
+    for (int i = 0; i < 300; ++i)
+    {
+        s.add(i);
+        t.add(i + 200);
+    }
+
+    n = s.estimate();
+    if (!s.sparse() || n < 290 || n > 310)
+        return false;
+
+    // sparse into sparse, then sparse into dense
+    if (!s.merge(t) || !s.sparse())
+        return false;
+
+    n = s.estimate();
+    if (n < 485 || n > 515)
+        return false;
+
+    for (int i = 0; i < 50000; ++i)
+        b.add(i + 1000000);
+
+    if (b.sparse() || !b.merge(s))
+        return false;
+
+    n = b.estimate();
+    if (n < 97000 || n > 103000)
+        return false;
+
+    // dense into sparse switches the target over
+    if (!t.merge(b) || t.sparse())
+        return false;
+
+    if (std::abs(t.estimate() - n) > n * 0.01)
+        return false;
+
+    // never below the true count
+    for (int i = 0; i < 1000; ++i)
+    {
+        if (c.estimate(i) < 100)
+            return false;
+    }
+
+    if (c.total() != 100000)
+        return false;
+
+    // a typed pointer and a length hash the bytes, not the pointer
+    Util::CountMinSketch e(0.001, 0.01);
+    uint8_t bytes[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    const uint8_t* p = bytes;
+    e.add(p, sizeof(bytes));
+    e.add(e.hash(p, sizeof(bytes)), 4);
+    e.add(7);
+    e.add(e.hash(7), 2);
+
+    return e.total() == 8 && e.estimate(p, sizeof(bytes)) == 5 && e.estimate(7) == 3;
+}
+
+static bool testIntrusiveHooks()
+{
+    static_assert(sizeof(Pooled) == 5 * sizeof(void*), "hooks without a vptr");
+
+    Pooled items[4];
+    int recycled = 0;
+    auto recycle = [&recycled](Pooled*) { ++recycled; };
+
+    Util::IntrusiveList<Pooled, Util::IntrusiveMemberHook<Pooled, &Pooled::ready>, decltype(recycle)> ready(recycle);
+    Util::IntrusiveList<Pooled, Util::IntrusiveMemberHook<Pooled, &Pooled::all>, Util::IntrusiveNoDispose> all;
+    for (int i = 0; i < 4; ++i)
+    {
+        items[i].i = i;
+        ready.push_back(&items[i]);
+        all.push_front(&items[i]);
+    }
+
+    ready.erase(&items[1]);
+    ready.pop_front();
+    if (recycled != 2 || ready.size() != 2 || all.size() != 4 || ready.front().i != 2 || all.front().i != 3)
+        return false;
+
+    all.clear();
+    if (recycled != 2 || ready.back().i != 3)
+        return false;
+
+    // a copy of a linked element starts out unlinked, the original keeps its place
+    auto copy = items[2];
+    if (copy.ready.prev || copy.ready.next || items[2].ready.next != &items[3])
+        return false;
+
+    // a capturing lambda moves along with the elements and stays put on swap
+    auto moved = std::move(ready);
+    decltype(moved) other(recycle);
+    other.push_back(&items[0]);
+    other.swap(moved);
+    moved.pop_front();
+    if (recycled != 3 || !ready.empty() || moved.size() != 0 || other.size() != 2)
+        return false;
+
+    moved = std::move(other);
+    moved.clear();
+    return recycled == 5 && other.empty();
+}
+
+// the same, through tagged base hooks; the tags needn't be defined
+struct ReadyTag;
+struct AllTag;
+struct LruTag;
+
+struct Conn
+    : public Util::IntrusiveListHook<Conn, ReadyTag>
+    , public Util::IntrusiveListHook<Conn, AllTag>
+    , public Util::IntrusiveListHook<Conn, LruTag>
+{
+    int id = 0;
+};
+
+static bool testTaggedHooks()
+{
+    static_assert(sizeof(Conn) == 7 * sizeof(void*), "three hooks, no vptr, no wrappers");
+
+    Conn conns[4];
+    Util::IntrusiveList<Conn, ReadyTag, Util::IntrusiveNoDispose> ready;
+    Util::IntrusiveList<Conn, AllTag, Util::IntrusiveNoDispose> all;
+    Util::IntrusiveList<Conn, LruTag, Util::IntrusiveNoDispose> lru;
+    for (int i = 0; i < 4; ++i)
+    {
+        conns[i].id = i;
+        all.push_back(&conns[i]);
+        lru.push_front(&conns[i]);
+        if (i % 2)
+            ready.push_back(&conns[i]);
+    }
+
+    // a hit moves a connection to the front of the lru list only
+    lru.unlink(&conns[0]);
+    lru.push_front(&conns[0]);
+    ready.pop_front();
+
+    if (ready.size() != 1 || ready.front().id != 3 || all.size() != 4 || all.front().id != 0 || all.back().id != 3)
+        return false;
+
+    int expected[] = { 0, 3, 2, 1 };
+    int n = 0;
+    for (auto const& c : lru)
+    {
+        if (c.id != expected[n++])
+            return false;
+    }
+
+    ready.clear();
+    lru.clear();
+    return n == 4 && all.size() == 4 && !static_cast<Util::IntrusiveListHook<Conn, LruTag>&>(conns[2]).next;
+}
+
+static bool testIntrusiveListSort()
+{
+    Pooled items[8];
+    Util::IntrusiveList<Pooled, Util::IntrusiveMemberHook<Pooled, &Pooled::all>, Util::IntrusiveNoDispose> a, b;
+    for (int i = 0; i < 8; ++i)
+    {
+        items[i].i = (i * 5) % 8;
+        (i < 5 ? a : b).push_back(&items[i]);
+    }
+
+    auto less = [](Pooled const& x, Pooled const& y) { return x.i < y.i; };
+    a.sort(less);
+    b.sort(less);
+    a.merge(b, less);
+
+    int expected = 0;
+    for (auto const& x : a)
+    {
+        if (x.i != expected++)
+            return false;
+    }
+
+    return expected == 8 && b.empty() && a.back().i == 7;
+}
+
+struct Task
+    : public Util::IntrusiveCircularHook
+{
+    int i = 0;
+};
+
+static bool testIntrusiveCircularList()
+{
+    using TaskList = Util::IntrusiveCircularList<Task, Util::IntrusiveCircularBaseHook<Task>, Util::IntrusiveNoDispose>;
+
+    Task tasks[6];
+    TaskList ready, waiting;
+    for (int i = 0; i < 6; ++i)
+    {
+        tasks[i].i = i;
+        (i < 3 ? ready : waiting).push_back(&tasks[i]);
+    }
+
+    // 0 1 2 | 3 4 5  ->  0 3 4 1 2 | 5
+    auto first = waiting.begin();
+    auto last = first;
+    ++last;
+    ++last;
+    ready.splice(TaskList::iterator_to(tasks[1]), waiting, first, last);
+
+    // a task can leave without its list
+    tasks[4].unlink();
+    ready.insert(ready.end(), &tasks[4]);
+
+    const int expected[] = { 0, 3, 1, 2, 4 };
+    auto it = ready.end();
+    for (int i = 4; i >= 0; --i)
+    {
+        if ((--it)->i != expected[i])
+            return false;
+    }
+
+    return it == ready.begin() && waiting.size() == 1 && waiting.front().i == 5;
+}
+
+struct Message
+    : public Util::IntrusiveMpscHook
+{
+    int producer = 0;
+    int seq = 0;
+};
+
+// each producer's messages must come out in the order it pushed them
+static bool testIntrusiveMpscQueue()
+{
+    const int kProducers = 2;
+    const int kMessages = 10000;
+
+    static Message messages[kProducers][kMessages];
+    Util::IntrusiveMpscQueue<Message> q;
+
+    std::thread producers[kProducers];
+    for (int p = 0; p < kProducers; ++p)
+    {
+        producers[p] = std::thread([&q, p]()
+        {
+            for (int i = 0; i < kMessages; ++i)
+            {
+                messages[p][i].producer = p;
+                messages[p][i].seq = i;
+                q.push(&messages[p][i]);
+            }
+        });
+    }
+
+    int next[kProducers] = {};
+    bool ordered = true;
+    for (int received = 0; received < kProducers * kMessages; )
+    {
+        received += int(q.consume([&](Message* m)
+        {
+            ordered = ordered && (m->seq == next[m->producer]++);
+        }));
+    }
+
+    for (auto& t : producers)
+        t.join();
+
+    return ordered && q.empty();
+}
+
+struct Block
+    : public Util::IntrusiveStackHook
+{
+    int owner = -1;
+};
+
+// blocks cycle between threads and the freelist; no block may be handed out twice
+static bool testIntrusiveStack()
+{
+    const int kThreads = 4;
+    const int kRounds = 20000;
+
+    static Block blocks[16];
+    Util::IntrusiveStack<Block> freelist;
+    for (auto& b : blocks)
+        freelist.push(&b);
+
+    std::atomic<bool> failed(false);
+    std::thread threads[kThreads];
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads[t] = std::thread([&freelist, &failed, t]()
+        {
+            for (int i = 0; i < kRounds; ++i)
+            {
+                auto b = freelist.pop();
+                if (!b)
+                    continue;
+
+                b->owner = t;
+                std::this_thread::yield();
+                if (b->owner != t)
+                    failed = true;
+
+                freelist.push(b);
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    int count = 0;
+    auto all = freelist.pop_all();
+    for (auto b = all; b; b = Util::IntrusiveStack<Block>::next(b))
+        ++count;
+
+    return !failed && count == 16 && freelist.empty();
+}
+
+struct Session
+    : public Util::IntrusiveListHook<Session>
+{
+    int id = 0;
+    std::string name;
+    Util::IntrusiveHashHook byId;
+    Util::IntrusiveHashHook byName;
+};
+
+struct SessionId
+{
+    int operator()(Session const& s) const noexcept
+    {
+        return s.id;
+    }
+};
+
+struct SessionName
+{
+    std::string const& operator()(Session const& s) const noexcept
+    {
+        return s.name;
+    }
+};
+
+// sessions live in a list and two indexes at once; the indexes grow through
+// several incremental rehashes while elements come and go
+static bool testIntrusiveHashTable()
+{
+    using ById = Util::IntrusiveHashTable<Session, SessionId, Util::MurmurHash<int>, Util::IntrusiveHashMemberHook<Session, &Session::byId>>;
+    using ByName = Util::IntrusiveHashTable<Session, SessionName, Util::MurmurHash<std::string>, Util::IntrusiveHashMemberHook<Session, &Session::byName>>;
+
+    std::vector<Session> sessions(1000);
+    Util::IntrusiveList<Session, Util::IntrusiveBaseHook<Session>, Util::IntrusiveNoDispose> all;
+    ById byId;
+    ByName byName;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto s = &sessions[i];
+        s->id = i;
+        s->name = "session" + std::to_string(i);
+        all.push_back(s);
+        if (!byId.insert(s) || !byName.insert(s))
+            return false;
+
+        // every third one leaves again
+        if (i % 3 == 2)
+        {
+            auto gone = &sessions[i - 1];
+            byId.erase(gone);
+            if (byName.erase(gone->name) != gone)
+                return false;
+            all.unlink(gone);
+        }
+    }
+
+    Session dup;
+    dup.id = 6;
+    if (byId.insert(&dup))
+        return false;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        bool present = i % 3 != 1;
+        auto s = byId.find(i);
+        if (present != (s == &sessions[i]) || present != byName.contains("session" + std::to_string(i)))
+            return false;
+    }
+
+    // transparent lookup, no std::string built
+    if (byName.find("session0") != &sessions[0])
+        return false;
+
+    size_t n = 0;
+    byId.forEach([&n](Session&) { ++n; });
+    if (n != all.size() || byId.size() != all.size() || byName.size() != all.size())
+        return false;
+
+    byId.clear();
+    byName.clear();
+    all.clear();
+    return byId.empty() && !byId.contains(0);
+}
+
+struct CachedPage
+    : public Util::LruCacheHook<CachedPage>
+{
+    explicit CachedPage(int key) noexcept
+        : key(key)
+    {
+    }
+
+    int key;
+};
+
+struct CachedPageKey
+{
+    int operator()(CachedPage const& p) const noexcept
+    {
+        return p.key;
+    }
+};
+
+// keys shifted by a per-cache offset, hashed with a per-cache seed
+struct OffsetPageKey
+{
+    int operator()(CachedPage const& p) const noexcept
+    {
+        return p.key + offset;
+    }
+
+    int offset = 0;
+};
+
+struct SeededPageHash
+{
+    size_t operator()(int key) const noexcept
+    {
+        ++*calls;
+        return Util::murmurHash3(&key, sizeof(key), seed);
+    }
+
+    uint32_t seed = 0;
+    int* calls = nullptr;
+};
+
+// a scan of one-off keys must not flush the entries that were hit
+static bool testLruCache()
+{
+    int disposed = 0;
+    auto dispose = [&disposed](CachedPage* p) { ++disposed; delete p; };
+
+    Util::LruCache<CachedPage, CachedPageKey, decltype(dispose)> cache(100, 0.8, dispose);
+    for (int k = 0; k < 50; ++k)
+        cache.insert(new CachedPage(k));
+
+    for (int k = 0; k < 50; ++k)
+    {
+        if (!cache.find(k))
+            return false;
+    }
+
+    for (int k = 1000; k < 2000; ++k)
+        cache.insert(new CachedPage(k));
+
+    for (int k = 0; k < 50; ++k)
+    {
+        if (!cache.contains(k))
+            return false;
+    }
+
+    if (cache.size() != 100 || disposed != 950)
+        return false;
+
+    // weights: one heavy entry pushes out the oldest probation entries first
+    cache.insert(new CachedPage(-1), 40);
+    if (cache.weight() > 100 || !cache.contains(-1) || !cache.contains(0) || cache.contains(1950) || !cache.contains(1999))
+        return false;
+
+    Util::ShardedLruCache<CachedPage, CachedPageKey> shared(64, 4);
+    for (int k = 0; k < 1000; ++k)
+        shared.insert(new CachedPage(k));
+
+    int found = 0;
+    shared.find(999, [&found](CachedPage& p) { found = p.key; });
+    if (found != 999 || shared.size() > 64 || shared.shardCount() != 4)
+        return false;
+
+    // the shards' indexes use the key extractor and hash they were given, and
+    // the shares add up to the capacity
+    int calls = 0;
+    Util::ShardedLruCache<CachedPage, OffsetPageKey, Util::IntrusiveDelete, SeededPageHash> offset(10, 4, 0.8, Util::IntrusiveDelete(), OffsetPageKey{ 1000 }, SeededPageHash{ 7, &calls });
+    for (int k = 0; k < 1000; ++k)
+        offset.insert(new CachedPage(k));
+
+    found = 0;
+    offset.find(1999, [&found](CachedPage& p) { found = p.key; });
+    return found == 999 && calls > 2000 && offset.size() == 10;
+}
+
+struct Deadline
+    : public Util::IntrusiveListHook<Deadline>
+    , public Util::IntrusiveTreeHook
+{
+    uint64_t due = 0;
+    int id = 0;
+};
+
+struct DeadlineDue
+{
+    uint64_t operator()(Deadline const& d) const noexcept
+    {
+        return d.due;
+    }
+};
+
+// deadlines are in a list of everything and an ordered index at once; equal
+// deadlines expire in the order they were added
+static bool testIntrusiveTree()
+{
+    Deadline deadlines[64];
+    Util::IntrusiveList<Deadline, Util::IntrusiveBaseHook<Deadline>, Util::IntrusiveNoDispose> all;
+    Util::IntrusiveMultiSet<Deadline, DeadlineDue> byDue;
+
+    for (int i = 0; i < 64; ++i)
+    {
+        deadlines[i].id = i;
+        deadlines[i].due = uint64_t((i * 37) % 16) * 10;
+        all.push_back(&deadlines[i]);
+        byDue.insert(&deadlines[i]);
+    }
+
+    // cancel every fourth one by element alone
+    for (int i = 0; i < 64; i += 4)
+        byDue.erase(&deadlines[i]);
+
+    if (byDue.size() != 48 || byDue.count(uint64_t(30)) != 4 || byDue.contains(uint64_t(0)))
+        return false;
+
+    auto first = byDue.lower_bound(uint64_t(25));
+    if (first == byDue.end() || first->due != 30 || byDue.upper_bound(uint64_t(140))->due != 150 || byDue.upper_bound(uint64_t(150)) != byDue.end())
+        return false;
+
+    uint64_t lastDue = 0;
+    int lastId = -1;
+    while (auto d = byDue.pop_front())
+    {
+        if (d->due < lastDue || (d->due == lastDue && d->id < lastId))
+            return false;
+
+        lastDue = d->due;
+        lastId = d->id;
+    }
+
+    return all.size() == 64 && !deadlines[1].Util::IntrusiveTreeHook::linked();
+}
+
+struct Expiring
+    : public Util::TimerWheelHook
+{
+    uint64_t due = 0;
+    int fired = 0;
+};
+
+// timers from 1 tick to beyond the wheel's range fire exactly on their tick,
+// rescheduled and cancelled ones move or stay quiet
+static bool testTimerWheel()
+{
+    const uint64_t kStart = 1000;
+    const uint64_t delays[] = { 1, 5, 63, 64, 65, 4095, 4096, 100000, 262144, 3000000, 20000000 };
+    const size_t kCount = sizeof(delays) / sizeof(delays[0]);
+
+    Util::TimerWheel<Expiring> wheel(kStart);
+    Expiring timers[kCount];
+    for (size_t i = 0; i < kCount; ++i)
+    {
+        timers[i].due = kStart + delays[i];
+        wheel.schedule(&timers[i], timers[i].due);
+    }
+
+    // moved later, and gone
+    timers[1].due = kStart + 70;
+    wheel.scheduleAfter(&timers[1], 70);
+    wheel.cancel(&timers[2]);
+
+    bool ok = true;
+    auto fire = [&wheel, &ok](Expiring& t)
+    {
+        ok = ok && t.due == wheel.now() && !t.scheduled();
+        ++t.fired;
+    };
+
+    // in uneven steps, sometimes idle for a long time
+    uint64_t now = kStart;
+    for (uint64_t step : { 3, 60, 1, 1000, 5000, 200000, 1, 4000000, 17000000 })
+    {
+        now += step;
+        wheel.advance(now, fire);
+        if (wheel.now() != now)
+            return false;
+    }
+
+    if (!ok || !wheel.empty() || wheel.nextEvent() != UINT64_MAX)
+        return false;
+
+    for (size_t i = 0; i < kCount; ++i)
+    {
+        if (timers[i].fired != (i == 2 ? 0 : 1))
+            return false;
+    }
+
+    return true;
+}
+
+// growing or shrinking the shard set only moves keys to or from the shard that changed
+static bool testConsistentHash()
+{
+    Util::RendezvousHash before, after;
+    for (uint64_t node = 0; node < 8; ++node)
+    {
+        before.addNode(node);
+        after.addNode(node);
+    }
+
+    after.removeNode(3);
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        auto a = Util::jumpShard(i, 10);
+        auto b = Util::jumpShard(i, 11);
+        if (a != b && b != 10)
+            return false;
+
+        auto x = before.routeKey(i);
+        if (x != 3 && after.routeKey(i) != x)
+            return false;
+    }
+
+    return true;
+}
+
 
 int main()
 {
@@ -44,6 +964,60 @@ int main()
 
     Core::Trace::finaliize();
 
+    if (!testMurmurHash128())
+        return 1;
+
+    if (!testMurmurHashStream())
+        return 1;
+
+    if (!testMurmurHashBatch())
+        return 1;
+
+    if (!testTreeHash())
+        return 1;
+
+    if (!testFlatHashMap())
+        return 1;
+
+    if (!testBloomFilter())
+        return 1;
+
+    if (!testSketches())
+        return 1;
+
+    if (!testConsistentHash())
+        return 1;
+
+    if (!testIntrusiveHooks())
+        return 1;
+
+    if (!testTaggedHooks())
+        return 1;
+
+    if (!testIntrusiveCircularList())
+        return 1;
+
+    if (!testIntrusiveListSort())
+        return 1;
+
+    if (!testIntrusiveMpscQueue())
+        return 1;
+
+    if (!testIntrusiveStack())
+        return 1;
+
+    if (!testIntrusiveHashTable())
+        return 1;
+
+    if (!testLruCache())
+        return 1;
+
+    if (!testIntrusiveTree())
+        return 1;
+
+    if (!testTimerWheel())
+        return 1;
+
     {
         Util::IntrusiveList<Doll> l;
         l.push_back(new Doll(1));
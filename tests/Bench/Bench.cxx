@@ -0,0 +1,1746 @@
+#define PERFTIMER_ENABLED
+
+#include "../../Core/Futex.hxx"
+#include "../../Core/IRefCounted.hxx"
+#include "../../Core/Trace.hxx"
+#include "../../Util/Benchmark.hxx"
+#include "../../Util/BloomFilter.hxx"
+#include "../../Util/ConsistentHash.hxx"
+#include "../../Util/CountMinSketch.hxx"
+#include "../../Util/FlatHashMap.hxx"
+#include "../../Util/HyperLogLog.hxx"
+#include "../../Util/IntrusiveCircularList.hxx"
+#include "../../Util/IntrusiveHashTable.hxx"
+#include "../../Util/IntrusiveList.hxx"
+#include "../../Util/IntrusiveMpscQueue.hxx"
+#include "../../Util/IntrusiveStack.hxx"
+#include "../../Util/IntrusiveTree.hxx"
+#include "../../Util/LruCache.hxx"
+#include "../../Util/murmurhash.hxx"
+#include "../../Util/murmurhash_batch.hxx"
+#include "../../Util/Strings.hxx"
+#include "../../Util/Timer.hxx"
+#include "../../Util/TimerWheel.hxx"
+#include "../../Util/TreeHash.hxx"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace Util::Benchmark;
+
+
+namespace
+{
+
+struct Item
+    : public Util::IntrusiveList<Item>::Node
+{
+    explicit Item(int i)
+        : i(i)
+    {
+    }
+
+    int i;
+};
+
+// the same payload with a vtable-free hook, owned by an array instead of the list
+struct PlainItem
+    : public Util::IntrusiveListHook<PlainItem>
+{
+    int i = 0;
+};
+
+using PlainList = Util::IntrusiveList<PlainItem, Util::IntrusiveBaseHook<PlainItem>, Util::IntrusiveNoDispose>;
+
+// a connection in a ready queue and an lru list at once, through tagged hooks...
+struct ReadyTag;
+struct LruTag;
+
+struct TaggedConn
+    : public Util::IntrusiveListHook<TaggedConn, ReadyTag>
+    , public Util::IntrusiveListHook<TaggedConn, LruTag>
+{
+    bool ready = false;
+    int i = 0;
+};
+
+// ...and the same kept in std::list wrappers, with the iterators to unlink them
+struct WrappedConn
+{
+    std::list<WrappedConn*>::iterator readyAt;
+    std::list<WrappedConn*>::iterator lruAt;
+    bool ready = false;
+    int i = 0;
+};
+
+struct RingItem
+    : public Util::IntrusiveCircularHook
+{
+    int i = 0;
+};
+
+using RingList = Util::IntrusiveCircularList<RingItem, Util::IntrusiveCircularBaseHook<RingItem>, Util::IntrusiveNoDispose>;
+
+class Counted
+    : public Core::RefCountedBase
+{
+};
+
+
+void registerMurmur(Registry& r)
+{
+    const size_t sizes[] = { 4, 16, 64, 1024, 64 * 1024 };
+    for (auto size : sizes)
+    {
+        auto name = std::string("murmurHash3/") + std::to_string(size);
+        r.add(name.c_str(), [size](uint64_t n)
+        {
+            std::vector<uint8_t> key(size, 0x5a);
+            uint32_t h = 0;
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                h = Util::murmurHash3(key.data(), key.size(), h);
+                doNotOptimize(h);
+            }
+        }, size);
+
+        name = std::string("murmurHash3_128/") + std::to_string(size);
+        r.add(name.c_str(), [size](uint64_t n)
+        {
+            std::vector<uint8_t> key(size, 0x5a);
+            uint32_t seed = 0;
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                auto h = Util::murmurHash3_128(key.data(), key.size(), seed);
+                seed = uint32_t(h.h1);
+                doNotOptimize(h);
+            }
+        }, size);
+    }
+
+    r.add("MurmurHash3Stream/64K in 100 byte chunks", [](uint64_t n)
+    {
+        std::vector<uint8_t> key(64 * 1024, 0x5a);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            Util::MurmurHash3Stream s{ uint32_t(i) };
+            for (size_t offset = 0; offset < key.size(); offset += 100)
+                s.update(key.data() + offset, std::min<size_t>(100, key.size() - offset));
+
+            doNotOptimize(s.finalize());
+        }
+    }, 64 * 1024);
+
+    // 64 MB, one thread vs. tree mode on every core
+    auto big = lazy([]() { return std::make_unique<std::vector<uint8_t>>(64 << 20, uint8_t(0x5a)); });
+    r.add("murmurHash3_128/64M", [big](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(Util::murmurHash3_128(big->data(), big->size(), uint32_t(i)));
+    }, 64 << 20);
+
+    r.add("murmurHash3Tree/64M", [big](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            doNotOptimize(Util::murmurHash3Tree(big->data(), big->size(), uint32_t(i)));
+    }, 64 << 20);
+
+    const size_t batchSizes[] = { 8, 16, 32, 64, 256 };
+    for (auto size : batchSizes)
+    {
+        // 1024 keys per iteration, scalar loop vs. the batch capped at each level;
+        // short keys should come out level with scalar, they are dispatched to it
+        const size_t kKeys = 1024;
+        auto name = std::string("murmurHash3/1024 keys x ") + std::to_string(size) + "/scalar";
+        r.add(name.c_str(), [size, kKeys](uint64_t n)
+        {
+            std::vector<uint8_t> keys(size * kKeys, 0x5a);
+            std::vector<uint32_t> out(kKeys);
+            for (uint64_t i = 0; i < n; ++i)
+            {
+                for (size_t k = 0; k < kKeys; ++k)
+                    out[k] = Util::murmurHash3(keys.data() + k * size, size, uint32_t(i));
+
+                doNotOptimize(out.data());
+            }
+        }, size * kKeys);
+
+        const char* levels[] = { "SSE4.1", "AVX2", "AVX-512" };
+        for (int l = int(Util::SimdLevel::SSE41); l <= int(Util::murmurHash3BatchLevel()); ++l)
+        {
+            name = std::string("murmurHash3/1024 keys x ") + std::to_string(size) + "/" + levels[l - 1];
+            r.add(name.c_str(), [size, kKeys, l](uint64_t n)
+            {
+                std::vector<uint8_t> keys(size * kKeys, 0x5a);
+                std::vector<uint32_t> out(kKeys);
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    Util::murmurHash3Batch(keys.data(), size, size, kKeys, uint32_t(i), out.data(), Util::SimdLevel(l));
+                    doNotOptimize(out.data());
+                }
+            }, size * kKeys);
+        }
+    }
+}
+
+// key sizes from 1 byte to 1 MB at every offset from an 8 byte boundary
+void registerMurmurAlignment(Registry& r)
+{
+    const size_t sizes[] = { 1, 16, 256, 4096, 64 * 1024, 1024 * 1024 };
+    for (auto size : sizes)
+    {
+        auto buffer = std::make_shared<std::vector<uint8_t>>(size + 8, uint8_t(0x5a));
+        for (size_t align = 0; align < 8; ++align)
+        {
+            auto key = buffer->data() + (8 - (uintptr_t(buffer->data()) & 7)) % 8 + align;
+            if (key + size > buffer->data() + buffer->size())
+                key -= 8;
+
+            auto name = "murmurHash3/align/" + std::to_string(size) + "+" + std::to_string(align);
+            r.add(name.c_str(), [buffer, key, size](uint64_t n)
+            {
+                uint32_t h = 0;
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    h = Util::murmurHash3(key, size, h);
+                    doNotOptimize(h);
+                }
+            }, size);
+
+            name = "murmurHash3_128/align/" + std::to_string(size) + "+" + std::to_string(align);
+            r.add(name.c_str(), [buffer, key, size](uint64_t n)
+            {
+                uint32_t seed = 0;
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    auto h = Util::murmurHash3_128(key, size, seed);
+                    seed = uint32_t(h.h1);
+                    doNotOptimize(h);
+                }
+            }, size);
+        }
+    }
+}
+
+// not timings: every key size must hash the same at every alignment, and flipping
+// one input bit should flip each output bit half of the time (avalanche)
+int runMurmurQuality()
+{
+    const size_t sizes[] = { 1, 2, 3, 4, 7, 8, 15, 16, 31, 64, 256, 4096, 64 * 1024, 1024 * 1024 };
+    const int kTrials = 200;
+    const size_t kInputBits = 64;   // sampled per trial for long keys
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> buffer(1024 * 1024 + 16);
+    std::vector<uint8_t> key;
+    int failures = 0;
+
+    std::printf("%-10s %10s %12s %12s\n", "key bytes", "alignment", "bias 32", "bias 128");
+    for (auto size : sizes)
+    {
+        key.resize(size);
+
+        // alignment
+        bool aligned = true;
+        for (int trial = 0; trial < 4; ++trial)
+        {
+            for (auto& b : key)
+                b = uint8_t(rng());
+
+            auto h32 = Util::murmurHash3(key.data(), size, 0);
+            auto h128 = Util::murmurHash3_128(key.data(), size, 0);
+            for (size_t offset = 0; offset < 16; ++offset)
+            {
+                std::memcpy(buffer.data() + offset, key.data(), size);
+                auto a128 = Util::murmurHash3_128(buffer.data() + offset, size, 0);
+                if (Util::murmurHash3(buffer.data() + offset, size, 0) != h32 || a128.h1 != h128.h1 || a128.h2 != h128.h2)
+                    aligned = false;
+            }
+        }
+
+        // avalanche: per (input bit, output bit) flip rate, worst distance from 1/2
+        auto inputBits = std::min(size * 8, kInputBits);
+        std::vector<int> flips32(inputBits * 32);
+        std::vector<int> flips128(inputBits * 128);
+        for (int trial = 0; trial < kTrials; ++trial)
+        {
+            for (auto& b : key)
+                b = uint8_t(rng());
+
+            auto h32 = Util::murmurHash3(key.data(), size, 0);
+            auto h128 = Util::murmurHash3_128(key.data(), size, 0);
+            for (size_t i = 0; i < inputBits; ++i)
+            {
+                auto bit = (inputBits == size * 8) ? i : (size_t(rng()) % (size * 8));
+                key[bit / 8] ^= uint8_t(1 << (bit % 8));
+
+                auto d32 = Util::murmurHash3(key.data(), size, 0) ^ h32;
+                auto d128 = Util::murmurHash3_128(key.data(), size, 0);
+                d128.h1 ^= h128.h1;
+                d128.h2 ^= h128.h2;
+
+                key[bit / 8] ^= uint8_t(1 << (bit % 8));
+
+                for (int o = 0; o < 32; ++o)
+                    flips32[i * 32 + o] += (d32 >> o) & 1;
+                for (int o = 0; o < 64; ++o)
+                {
+                    flips128[i * 128 + o] += int((d128.h1 >> o) & 1);
+                    flips128[i * 128 + 64 + o] += int((d128.h2 >> o) & 1);
+                }
+            }
+        }
+
+        auto worst = [](std::vector<int> const& flips)
+        {
+            double w = 0;
+            for (auto f : flips)
+                w = std::max(w, std::fabs(double(f) / kTrials - 0.5));
+            return w;
+        };
+
+        std::printf("%-10zu %10s %12.3f %12.3f\n", size, aligned ? "ok" : "MISMATCH", worst(flips32), worst(flips128));
+        if (!aligned)
+            ++failures;
+    }
+
+    // the worst of thousands of (input bit, output bit) pairs lands around 5 standard deviations out
+    std::printf("bias is the worst |P(flip) - 0.5| over %d trials; sampling noise alone reaches ~%.2f\n", kTrials, 2.5 / std::sqrt(double(kTrials)));
+    return failures ? 1 : 0;
+}
+
+void registerIntrusiveList(Registry& r)
+{
+    r.add("IntrusiveList/push_back+pop_front", [](uint64_t n)
+    {
+        Util::IntrusiveList<Item> l;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            l.push_back(new Item(int(i)));
+            l.pop_front();
+        }
+    });
+
+    r.add("IntrusiveList/iterate1024", [](uint64_t n)
+    {
+        Util::IntrusiveList<Item> l;
+        for (int i = 0; i < 1024; ++i)
+            l.push_back(new Item(i));
+
+        for (uint64_t i = 0; i < n; i += 1024)
+        {
+            int sum = 0;
+            for (auto const& x : l)
+                sum += x.i;
+
+            doNotOptimize(sum);
+        }
+    }, sizeof(Item));
+
+    r.add("IntrusiveList/push_back+pop_front no vtable, no delete", [](uint64_t n)
+    {
+        PlainItem items[64];
+        PlainList l;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            l.push_back(&items[i % 64]);
+            l.pop_front();
+        }
+
+        clobberMemory();
+    });
+
+    r.add("IntrusiveList/iterate1024 no vtable", [](uint64_t n)
+    {
+        std::vector<PlainItem> items(1024);
+        PlainList l;
+        for (int i = 0; i < 1024; ++i)
+        {
+            items[i].i = i;
+            l.push_back(&items[i]);
+        }
+
+        for (uint64_t i = 0; i < n; i += 1024)
+        {
+            int sum = 0;
+            for (auto const& x : l)
+                sum += x.i;
+
+            doNotOptimize(sum);
+        }
+    }, sizeof(PlainItem));
+
+    r.add("IntrusiveCircularList/push_back+pop_front", [](uint64_t n)
+    {
+        RingItem items[64];
+        RingList l;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            l.push_back(&items[i % 64]);
+            l.pop_front();
+        }
+
+        clobberMemory();
+    });
+
+    // random unlinks and re-inserts, the pattern of a ready queue
+    r.add("IntrusiveList/unlink+push_back random", [](uint64_t n)
+    {
+        std::vector<PlainItem> items(1024);
+        PlainList l;
+        for (auto& x : items)
+            l.push_back(&x);
+
+        std::mt19937 rng(1);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto x = &items[rng() % items.size()];
+            l.unlink(x);
+            l.push_back(x);
+        }
+
+        clobberMemory();
+    });
+
+    // an event on a random connection: it becomes ready and most recently used,
+    // and the oldest ready one is served
+    r.add("IntrusiveList/ready+lru tagged hooks", [](uint64_t n)
+    {
+        std::vector<TaggedConn> conns(1024);
+        Util::IntrusiveList<TaggedConn, ReadyTag, Util::IntrusiveNoDispose> ready;
+        Util::IntrusiveList<TaggedConn, LruTag, Util::IntrusiveNoDispose> lru;
+        for (auto& c : conns)
+            lru.push_back(&c);
+
+        std::mt19937 rng(1);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto c = &conns[rng() % conns.size()];
+            lru.unlink(c);
+            lru.push_front(c);
+            if (!c->ready)
+            {
+                c->ready = true;
+                ready.push_back(c);
+            }
+
+            auto served = &ready.front();
+            served->ready = false;
+            ready.pop_front();
+            doNotOptimize(served->i);
+        }
+    });
+
+    r.add("IntrusiveList/ready+lru std::list of pointers", [](uint64_t n)
+    {
+        std::vector<WrappedConn> conns(1024);
+        std::list<WrappedConn*> ready;
+        std::list<WrappedConn*> lru;
+        for (auto& c : conns)
+            c.lruAt = lru.insert(lru.end(), &c);
+
+        std::mt19937 rng(1);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto c = &conns[rng() % conns.size()];
+            lru.splice(lru.begin(), lru, c->lruAt);
+            if (!c->ready)
+            {
+                c->ready = true;
+                c->readyAt = ready.insert(ready.end(), c);
+            }
+
+            auto served = ready.front();
+            served->ready = false;
+            ready.pop_front();
+            doNotOptimize(served->i);
+        }
+    });
+
+    r.add("IntrusiveCircularList/unlink+push_back random", [](uint64_t n)
+    {
+        std::vector<RingItem> items(1024);
+        RingList l;
+        for (auto& x : items)
+            l.push_back(&x);
+
+        std::mt19937 rng(1);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto x = &items[rng() % items.size()];
+            x->unlink();
+            l.push_back(x);
+        }
+
+        clobberMemory();
+        l.clear();
+    });
+
+    r.add("IntrusiveCircularList/splice half", [](uint64_t n)
+    {
+        std::vector<RingItem> items(1024);
+        RingList a, b;
+        for (auto& x : items)
+            a.push_back(&x);
+
+        auto middle = RingList::iterator_to(items[512]);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            b.splice(b.end(), a, middle, a.end());
+            a.splice(a.end(), b);
+        }
+
+        clobberMemory();
+        a.clear();
+    });
+
+    // sort() against the copy-to-vector, sort, relink workaround it replaces
+    const size_t kSortItems = 1 << 16;
+    auto keys = std::make_shared<std::vector<int>>(kSortItems);
+    std::mt19937 rng(1);
+    for (auto& k : *keys)
+        k = int(rng());
+
+    r.add("IntrusiveList/sort 64K", [keys](uint64_t n)
+    {
+        std::vector<PlainItem> items(keys->size());
+        for (uint64_t i = 0; i < n; i += keys->size())
+        {
+            PlainList l;
+            for (size_t k = 0; k < items.size(); ++k)
+            {
+                items[k].i = (*keys)[k];
+                l.push_back(&items[k]);
+            }
+
+            l.sort([](PlainItem const& a, PlainItem const& b) { return a.i < b.i; });
+            doNotOptimize(l.front());
+        }
+    });
+
+    r.add("IntrusiveList/sort 64K via vector", [keys](uint64_t n)
+    {
+        std::vector<PlainItem> items(keys->size());
+        for (uint64_t i = 0; i < n; i += keys->size())
+        {
+            PlainList l;
+            for (size_t k = 0; k < items.size(); ++k)
+            {
+                items[k].i = (*keys)[k];
+                l.push_back(&items[k]);
+            }
+
+            std::vector<PlainItem*> v;
+            v.reserve(l.size());
+            while (!l.empty())
+            {
+                v.push_back(&l.front());
+                l.pop_front();
+            }
+
+            std::stable_sort(v.begin(), v.end(), [](PlainItem const* a, PlainItem const* b) { return a->i < b->i; });
+            for (auto p : v)
+                l.push_back(p);
+
+            doNotOptimize(l.front());
+        }
+    });
+}
+
+struct QueuedItem
+    : public Util::IntrusiveListHook<QueuedItem>
+    , public Util::IntrusiveMpscHook
+{
+    int i = 0;
+};
+
+// kProducers threads push n items between them while this thread drains them
+template <typename _Push, typename _Drain>
+void runProducers(uint64_t n, _Push push, _Drain drain)
+{
+    const unsigned kProducers = 4;
+
+    std::vector<QueuedItem> items(size_t(n) + 1);
+    std::vector<std::thread> producers;
+    for (unsigned p = 0; p < kProducers; ++p)
+    {
+        producers.emplace_back([&items, &push, n, p]()
+        {
+            for (auto i = p; i < n; i += kProducers)
+                push(&items[i]);
+        });
+    }
+
+    for (uint64_t received = 0; received < n; )
+        received += drain();
+
+    for (auto& t : producers)
+        t.join();
+}
+
+void registerQueues(Registry& r)
+{
+    r.add("IntrusiveMpscQueue/push+pop", [](uint64_t n)
+    {
+        QueuedItem items[64];
+        Util::IntrusiveMpscQueue<QueuedItem> q;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            q.push(&items[i % 64]);
+            doNotOptimize(q.pop());
+        }
+    });
+
+    r.add("IntrusiveMpscQueue/4 producers", [](uint64_t n)
+    {
+        Util::IntrusiveMpscQueue<QueuedItem> q;
+        runProducers(n,
+            [&q](QueuedItem* x) { q.push(x); },
+            [&q]() { return uint64_t(q.consume([](QueuedItem* x) { doNotOptimize(x); })); });
+    });
+
+    r.add("Futex+IntrusiveList/4 producers", [](uint64_t n)
+    {
+        Core::Futex lock;
+        Util::IntrusiveList<QueuedItem, Util::IntrusiveBaseHook<QueuedItem>, Util::IntrusiveNoDispose> l;
+        runProducers(n,
+            [&](QueuedItem* x)
+            {
+                std::lock_guard<Core::Futex> g(lock);
+                l.push_back(x);
+            },
+            [&]()
+            {
+                uint64_t received = 0;
+                std::lock_guard<Core::Futex> g(lock);
+                while (!l.empty())
+                {
+                    doNotOptimize(&l.front());
+                    l.pop_front();
+                    ++received;
+                }
+
+                return received;
+            });
+    });
+}
+
+struct FreeBlock
+    : public Util::IntrusiveStackHook
+{
+    char payload[48];
+};
+
+// kThreads threads each take and return blocks n / kThreads times
+template <typename _Take, typename _Give>
+void runFreelist(uint64_t n, _Take take, _Give give)
+{
+    const unsigned kThreads = 4;
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&take, &give, n]()
+        {
+            for (uint64_t i = 0; i < n / kThreads; ++i)
+            {
+                auto b = take();
+                if (b)
+                {
+                    doNotOptimize(b->payload[0]);
+                    give(b);
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+}
+
+void registerFreelists(Registry& r)
+{
+    r.add("IntrusiveStack/push+pop", [](uint64_t n)
+    {
+        FreeBlock blocks[64];
+        Util::IntrusiveStack<FreeBlock> s;
+        for (auto& b : blocks)
+            s.push(&b);
+
+        for (uint64_t i = 0; i < n; ++i)
+            s.push(s.pop());
+
+        clobberMemory();
+    });
+
+    r.add("IntrusiveStack/4 threads", [](uint64_t n)
+    {
+        std::vector<FreeBlock> blocks(64);
+        Util::IntrusiveStack<FreeBlock> s;
+        for (auto& b : blocks)
+            s.push(&b);
+
+        runFreelist(n, [&s]() { return s.pop(); }, [&s](FreeBlock* b) { s.push(b); });
+    });
+
+    r.add("Futex+vector/4 threads", [](uint64_t n)
+    {
+        std::vector<FreeBlock> blocks(64);
+        std::vector<FreeBlock*> free;
+        for (auto& b : blocks)
+            free.push_back(&b);
+
+        Core::Futex lock;
+        runFreelist(n,
+            [&]() -> FreeBlock*
+            {
+                std::lock_guard<Core::Futex> g(lock);
+                if (free.empty())
+                    return nullptr;
+
+                auto b = free.back();
+                free.pop_back();
+                return b;
+            },
+            [&](FreeBlock* b)
+            {
+                std::lock_guard<Core::Futex> g(lock);
+                free.push_back(b);
+            });
+    });
+}
+
+struct CacheEntry
+    : public Util::LruCacheHook<CacheEntry>
+{
+    uint32_t key = 0;
+    char payload[32];
+};
+
+struct CacheEntryKey
+{
+    uint32_t operator()(CacheEntry const& e) const noexcept
+    {
+        return e.key;
+    }
+};
+
+// the hand-rolled cache this replaces: a recency list plus a map into it
+class ListMapCache
+{
+public:
+    explicit ListMapCache(size_t capacity)
+        : m_capacity(capacity)
+    {
+    }
+
+    // true on a hit
+    bool access(uint32_t key)
+    {
+        auto it = m_map.find(key);
+        if (it != m_map.end())
+        {
+            m_list.splice(m_list.begin(), m_list, it->second);
+            return true;
+        }
+
+        m_list.emplace_front();
+        m_list.front().key = key;
+        m_map.emplace(key, m_list.begin());
+        if (m_list.size() > m_capacity)
+        {
+            m_map.erase(m_list.back().key);
+            m_list.pop_back();
+        }
+
+        return false;
+    }
+
+private:
+    std::list<CacheEntry> m_list;
+    std::unordered_map<uint32_t, std::list<CacheEntry>::iterator, Util::MurmurHash<uint32_t>> m_map;
+    size_t m_capacity;
+};
+
+// 3/4 of the accesses go to 1024 hot keys, the rest scan a 1M key space; the
+// caches hold 4096 entries
+std::shared_ptr<std::vector<uint32_t>> cacheWorkload()
+{
+    auto keys = std::make_shared<std::vector<uint32_t>>(64 * 1024);
+    std::mt19937 rng(7);
+    for (auto& k : *keys)
+        k = (rng() & 3) ? rng() % 1024 : 1024 + rng() % (1024 * 1024);
+
+    return keys;
+}
+
+// kThreads threads each make n / kThreads accesses, starting at different offsets
+template <typename _Access>
+void runCacheThreads(uint64_t n, std::vector<uint32_t> const& keys, _Access access)
+{
+    const unsigned kThreads = 4;
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&keys, &access, n, t]()
+        {
+            size_t hits = 0;
+            for (uint64_t i = 0; i < n / kThreads; ++i)
+                hits += access(keys[(i + t * 4099) % keys.size()]);
+
+            doNotOptimize(hits);
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+}
+
+void registerLruCache(Registry& r)
+{
+    const size_t kCapacity = 4096;
+    auto keys = cacheWorkload();
+
+    // entries come from a pool and go back to it, so a miss allocates nothing
+    r.add("LruCache/get-or-insert", [keys](uint64_t n)
+    {
+        std::vector<CacheEntry> pool(kCapacity + 1);
+        std::vector<CacheEntry*> free;
+        for (auto& e : pool)
+            free.push_back(&e);
+
+        auto recycle = [&free](CacheEntry* e) { free.push_back(e); };
+        Util::LruCache<CacheEntry, CacheEntryKey, decltype(recycle)> cache(kCapacity, 0.8, recycle);
+
+        size_t hits = 0;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto key = (*keys)[i % keys->size()];
+            if (cache.find(key))
+            {
+                ++hits;
+                continue;
+            }
+
+            auto e = free.back();
+            free.pop_back();
+            e->key = key;
+            cache.insert(e);
+        }
+
+        doNotOptimize(hits);
+    });
+
+    r.add("list+unordered_map/get-or-insert", [keys](uint64_t n)
+    {
+        ListMapCache cache(kCapacity);
+
+        size_t hits = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            hits += cache.access((*keys)[i % keys->size()]);
+
+        doNotOptimize(hits);
+    });
+
+    r.add("ShardedLruCache/4 threads", [keys](uint64_t n)
+    {
+        Util::ShardedLruCache<CacheEntry, CacheEntryKey, Util::IntrusiveDelete, Util::MurmurHash<uint32_t>, std::equal_to<>, Core::Futex> cache(kCapacity, 16);
+
+        runCacheThreads(n, *keys, [&cache](uint32_t key)
+        {
+            if (cache.find(key, [](CacheEntry& e) { doNotOptimize(e.payload[0]); }))
+                return true;
+
+            auto e = new CacheEntry;
+            e->key = key;
+            if (!cache.insert(e))
+                delete e;
+
+            return false;
+        });
+    });
+
+    r.add("Futex+list+unordered_map/4 threads", [keys](uint64_t n)
+    {
+        ListMapCache cache(kCapacity);
+        Core::Futex lock;
+
+        runCacheThreads(n, *keys, [&cache, &lock](uint32_t key)
+        {
+            std::lock_guard<Core::Futex> g(lock);
+            return cache.access(key);
+        });
+    });
+}
+
+struct TimeoutItem
+    : public Util::IntrusiveTreeHook
+{
+    uint64_t due = 0;
+    char payload[32];
+};
+
+struct TimeoutDue
+{
+    uint64_t operator()(TimeoutItem const& t) const noexcept
+    {
+        return t.due;
+    }
+};
+
+// the tree is declared after its elements, so it is gone before they are
+struct TimeoutTree
+{
+    std::vector<TimeoutItem> items;
+    Util::IntrusiveMultiSet<TimeoutItem, TimeoutDue> tree;
+};
+
+struct TimeoutMap
+{
+    std::vector<TimeoutItem> items;
+    std::multimap<uint64_t, TimeoutItem*> map;
+    std::vector<std::multimap<uint64_t, TimeoutItem*>::iterator> handles;
+};
+
+// a deadline index of 64K timeouts: rearm moves one timeout to a later deadline
+// (cancel plus insert), expire takes the earliest one and rearms it
+void registerOrderedIndex(Registry& r)
+{
+    const size_t kTimeouts = 64 * 1024;
+
+    // built on first use, outside the timed bodies; both get the same deadlines
+    auto t = lazy([]()
+    {
+        auto t = std::make_unique<TimeoutTree>();
+        t->items.resize(kTimeouts);
+
+        std::mt19937_64 rng(11);
+        for (auto& item : t->items)
+        {
+            item.due = rng() % 1000000;
+            t->tree.insert(&item);
+        }
+
+        return t;
+    });
+
+    auto m = lazy([]()
+    {
+        auto m = std::make_unique<TimeoutMap>();
+        m->items.resize(kTimeouts);
+
+        std::mt19937_64 rng(11);
+        for (auto& item : m->items)
+        {
+            item.due = rng() % 1000000;
+            m->handles.push_back(m->map.emplace(item.due, &item));
+        }
+
+        return m;
+    });
+
+    r.add("IntrusiveMultiSet/rearm", [t](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto item = &t->items[(i * 40503) % kTimeouts];
+            t->tree.erase(item);
+            item->due += 1000000;
+            t->tree.insert(item);
+        }
+
+        clobberMemory();
+    });
+
+    r.add("multimap/rearm", [m](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto k = (i * 40503) % kTimeouts;
+            auto item = &m->items[k];
+            m->map.erase(m->handles[k]);
+            item->due += 1000000;
+            m->handles[k] = m->map.emplace(item->due, item);
+        }
+
+        clobberMemory();
+    });
+
+    r.add("IntrusiveMultiSet/expire", [t](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto item = t->tree.pop_front();
+            item->due += 1000000;
+            t->tree.insert(item);
+        }
+
+        clobberMemory();
+    });
+
+    // the handles go stale here, which rearm above no longer needs
+    r.add("multimap/expire", [m](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto first = m->map.begin();
+            auto item = first->second;
+            m->map.erase(first);
+            item->due += 1000000;
+            m->map.emplace(item->due, item);
+        }
+
+        clobberMemory();
+    });
+}
+
+struct WheelTimer
+    : public Util::TimerWheelHook
+{
+    uint64_t due = 0;
+};
+
+struct TimerSet
+{
+    std::vector<WheelTimer> timers;
+    Util::TimerWheel<WheelTimer> wheel;
+};
+
+// 64K connection timeouts spread over a minute of 1 ms ticks: rearm is what a
+// connection does on every packet, tick is the clock moving on
+void registerTimerWheel(Registry& r)
+{
+    const size_t kTimers = 64 * 1024;
+    const uint64_t kSpread = 60000;
+
+    auto ts = lazy([]()
+    {
+        auto ts = std::make_unique<TimerSet>();
+        ts->timers.resize(kTimers);
+
+        std::mt19937_64 rng(13);
+        for (auto& t : ts->timers)
+        {
+            t.due = 1 + rng() % kSpread;
+            ts->wheel.schedule(&t, t.due);
+        }
+
+        return ts;
+    });
+
+    r.add("TimerWheel/rearm", [ts](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto t = &ts->timers[(i * 40503) % kTimers];
+            t->due += kSpread;
+            ts->wheel.schedule(t, t->due);
+        }
+
+        clobberMemory();
+    });
+
+    // the same rearm on the multimap deadline index, with the same deadlines
+    auto m = lazy([]()
+    {
+        auto m = std::make_unique<TimeoutMap>();
+        m->items.resize(kTimers);
+
+        std::mt19937_64 rng(13);
+        for (auto& item : m->items)
+        {
+            item.due = 1 + rng() % kSpread;
+            m->handles.push_back(m->map.emplace(item.due, &item));
+        }
+
+        return m;
+    });
+
+    r.add("multimap/rearm timeout", [m](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto k = (i * 40503) % kTimers;
+            auto item = &m->items[k];
+            m->map.erase(m->handles[k]);
+            item->due += kSpread;
+            m->handles[k] = m->map.emplace(item->due, item);
+        }
+
+        clobberMemory();
+    });
+
+    // steady state: every tick fires about one timer, which rearms itself
+    auto steady = lazy([]()
+    {
+        auto steady = std::make_unique<TimerSet>();
+        steady->timers.resize(kTimers);
+
+        std::mt19937_64 rng(17);
+        for (auto& t : steady->timers)
+            steady->wheel.schedule(&t, 1 + rng() % kSpread);
+
+        return steady;
+    });
+
+    r.add("TimerWheel/tick", [steady](uint64_t n)
+    {
+        auto& wheel = steady->wheel;
+        uint64_t seed = wheel.now();
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            wheel.advance(wheel.now() + 1, [&wheel, &seed](WheelTimer& t)
+            {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                wheel.scheduleAfter(&t, 1 + (seed >> 33) % kSpread);
+            });
+        }
+    });
+
+    // a tick with nothing due, 64K timers pending
+    r.add("TimerWheel/idle tick", [](uint64_t n)
+    {
+        TimerSet local;
+        local.timers.resize(kTimers);
+        for (auto& t : local.timers)
+            local.wheel.schedule(&t, Util::TimerWheel<WheelTimer>::kRange * 2);
+
+        for (uint64_t i = 0; i < n; ++i)
+            local.wheel.advance(local.wheel.now() + 1, [](WheelTimer&) {});
+
+        doNotOptimize(local.wheel.now());
+    });
+}
+
+// the same workloads for FlatHashMap and std::unordered_map, both hashed with MurmurHash
+template <typename _Map>
+void registerMap(Registry& r, const char* prefix)
+{
+    const size_t kKeys = 4096;
+
+    r.add((std::string(prefix) + "/insert 4096").c_str(), [](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; i += kKeys)
+        {
+            _Map m;
+            for (uint64_t k = 0; k < kKeys; ++k)
+                m[k * 0x9e3779b97f4a7c15ULL] = k;
+
+            doNotOptimize(m);
+        }
+    });
+
+    // built on first use, outside the timed bodies
+    auto m = lazy([]()
+    {
+        auto m = std::make_unique<_Map>();
+        for (uint64_t k = 0; k < kKeys; ++k)
+            (*m)[k * 0x9e3779b97f4a7c15ULL] = k;
+
+        return m;
+    });
+
+    r.add((std::string(prefix) + "/find hit").c_str(), [m](uint64_t n)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            sum += m->find((i % kKeys) * 0x9e3779b97f4a7c15ULL)->second;
+
+        doNotOptimize(sum);
+    });
+
+    r.add((std::string(prefix) + "/find miss").c_str(), [m](uint64_t n)
+    {
+        size_t found = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            found += (m->find(i * 0x9e3779b97f4a7c15ULL + 1) != m->end());
+
+        doNotOptimize(found);
+    });
+}
+
+template <typename _Map>
+void registerStringMap(Registry& r, const char* prefix)
+{
+    auto names = lazy([]()
+    {
+        auto names = std::make_unique<std::vector<std::string>>();
+        for (int k = 0; k < 1024; ++k)
+            names->push_back("Module" + std::to_string(k));
+
+        return names;
+    });
+
+    auto m = lazy([names]()
+    {
+        auto m = std::make_unique<_Map>();
+        for (size_t k = 0; k < names->size(); ++k)
+            (*m)[(*names)[k]] = int(k);
+
+        return m;
+    });
+
+    r.add((std::string(prefix) + "/find string").c_str(), [m, names](uint64_t n)
+    {
+        int sum = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            sum += m->find((*names)[i % names->size()])->second;
+
+        doNotOptimize(sum);
+    });
+}
+
+void registerHashMaps(Registry& r)
+{
+    registerMap<Util::FlatHashMap<uint64_t, uint64_t>>(r, "FlatHashMap");
+    registerMap<std::unordered_map<uint64_t, uint64_t, Util::MurmurHash<uint64_t>>>(r, "unordered_map");
+
+    registerStringMap<Util::FlatHashMap<std::string, int>>(r, "FlatHashMap");
+    registerStringMap<std::unordered_map<std::string, int, Util::MurmurHash<std::string>>>(r, "unordered_map");
+
+    r.add("FlatHashMap/find const char*", [](uint64_t n)
+    {
+        Util::FlatHashMap<std::string, int> m;
+        m["Main"] = 1;
+        m["Bench"] = 2;
+        m["Trace"] = 3;
+
+        const char* keys[] = { "Main", "Bench", "Trace", "Other" };
+        size_t found = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            found += m.contains(keys[i & 3]);
+
+        doNotOptimize(found);
+    });
+}
+
+struct IndexedItem
+    : public Util::IntrusiveHashHook
+{
+    uint64_t key = 0;
+    uint64_t value = 0;
+};
+
+struct IndexedKey
+{
+    uint64_t operator()(IndexedItem const& item) const noexcept
+    {
+        return item.key;
+    }
+};
+
+// the table is declared after its elements, so it is gone before they are
+struct IndexedItems
+{
+    std::vector<IndexedItem> items;
+    Util::IntrusiveHashTable<IndexedItem, IndexedKey> table;
+};
+
+// an index over objects that already exist: the intrusive table against maps of pointers
+void registerIntrusiveHashTable(Registry& r)
+{
+    const size_t kKeys = 4096;
+    using Table = Util::IntrusiveHashTable<IndexedItem, IndexedKey>;
+    using PtrMap = std::unordered_map<uint64_t, IndexedItem*, Util::MurmurHash<uint64_t>>;
+
+    // built on first use, outside the timed bodies; the maps point at the
+    // table's elements
+    auto indexed = lazy([]()
+    {
+        auto indexed = std::make_unique<IndexedItems>();
+        indexed->items.resize(kKeys);
+        for (uint64_t k = 0; k < kKeys; ++k)
+        {
+            auto& item = indexed->items[k];
+            item.key = k * 0x9e3779b97f4a7c15ULL;
+            item.value = k;
+            indexed->table.insert(&item);
+        }
+
+        return indexed;
+    });
+
+    auto flat = lazy([indexed]()
+    {
+        auto flat = std::make_unique<Util::FlatHashMap<uint64_t, IndexedItem*>>();
+        for (auto& item : indexed->items)
+            (*flat)[item.key] = &item;
+
+        return flat;
+    });
+
+    auto map = lazy([indexed]()
+    {
+        auto map = std::make_unique<PtrMap>();
+        for (auto& item : indexed->items)
+            (*map)[item.key] = &item;
+
+        return map;
+    });
+
+    // its own elements, a hook can only be in one table
+    auto spare = lazy([indexed]() { return std::make_unique<std::vector<IndexedItem>>(indexed->items); });
+    r.add("IntrusiveHashTable/insert 4096", [spare](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; i += kKeys)
+        {
+            Table t;
+            for (auto& item : *spare)
+                t.insert(&item);
+
+            doNotOptimize(t);
+            t.clear();
+        }
+    });
+
+    r.add("unordered_map<ptr>/insert 4096", [spare](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; i += kKeys)
+        {
+            PtrMap m;
+            for (auto& item : *spare)
+                m[item.key] = &item;
+
+            doNotOptimize(m);
+        }
+    });
+
+    r.add("IntrusiveHashTable/find hit", [indexed](uint64_t n)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            sum += indexed->table.find((i % kKeys) * 0x9e3779b97f4a7c15ULL)->value;
+
+        doNotOptimize(sum);
+    });
+
+    r.add("FlatHashMap<ptr>/find hit", [indexed, flat](uint64_t n)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            sum += flat->find((i % kKeys) * 0x9e3779b97f4a7c15ULL)->second->value;
+
+        doNotOptimize(sum);
+    });
+
+    r.add("unordered_map<ptr>/find hit", [indexed, map](uint64_t n)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            sum += map->find((i % kKeys) * 0x9e3779b97f4a7c15ULL)->second->value;
+
+        doNotOptimize(sum);
+    });
+
+    // steady state churn: the table never allocates, the node map does on every insert
+    r.add("IntrusiveHashTable/erase+insert", [indexed](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto item = &indexed->items[i % kKeys];
+            indexed->table.erase(item);
+            indexed->table.insert(item);
+        }
+
+        clobberMemory();
+    });
+
+    r.add("unordered_map<ptr>/erase+insert", [indexed, map](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto item = &indexed->items[i % kKeys];
+            map->erase(item->key);
+            map->emplace(item->key, item);
+        }
+
+        clobberMemory();
+    });
+}
+
+// 4M keys, so the filter (~5 MB) does not fit the caches; queries are half hits
+void registerBloomFilter(Registry& r)
+{
+    const size_t kKeys = 4 * 1024 * 1024;
+    const size_t kBatch = 1024;
+
+    auto filter = lazy([kKeys]()
+    {
+        auto filter = std::make_unique<Util::BloomFilter>(kKeys, 0.01);
+        for (uint64_t k = 0; k < kKeys; ++k)
+            filter->insert(k * 2);
+
+        return filter;
+    });
+
+    auto hashes = lazy([filter]()
+    {
+        auto hashes = std::make_unique<std::vector<Util::Hash128>>();
+        std::mt19937_64 rng(1);
+        for (size_t i = 0; i < 64 * kBatch; ++i)
+        {
+            auto key = rng() % (kKeys * 2);
+            hashes->push_back(filter->hash(&key, sizeof(key)));
+        }
+
+        return hashes;
+    });
+
+    r.add("BloomFilter/mayContain", [filter, hashes](uint64_t n)
+    {
+        size_t found = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            found += filter->mayContain((*hashes)[i % hashes->size()]);
+
+        doNotOptimize(found);
+    });
+
+    r.add("BloomFilter/mayContain batch", [filter, hashes](uint64_t n)
+    {
+        bool out[kBatch];
+        for (uint64_t i = 0; i < n; i += kBatch)
+        {
+            auto first = (i / kBatch * kBatch) % hashes->size();
+            filter->mayContain(hashes->data() + first, kBatch, out);
+            doNotOptimize(out);
+        }
+    });
+
+    auto counting = lazy([]() { return std::make_unique<Util::CountingBloomFilter>(1024 * 1024, 0.01); });
+    r.add("CountingBloomFilter/insert+erase", [counting](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto h = counting->hash(&i, sizeof(i));
+            counting->insert(h);
+            counting->erase(h);
+        }
+
+        clobberMemory();
+    });
+}
+
+void registerSketches(Registry& r)
+{
+    r.add("HyperLogLog/addHash", [](uint64_t n)
+    {
+        Util::HyperLogLog h;
+        for (uint64_t i = 0; i < n; ++i)
+            h.addHash(i * 0x9e3779b97f4a7c15ull);
+
+        doNotOptimize(h);
+    });
+
+    // two overlapping sets of 1M keys
+    auto dense = lazy([]()
+    {
+        auto h = std::make_unique<Util::HyperLogLog>();
+        for (uint64_t i = 0; i < 1000000; ++i)
+            h->add(i);
+
+        return h;
+    });
+
+    auto other = lazy([]()
+    {
+        auto h = std::make_unique<Util::HyperLogLog>();
+        for (uint64_t i = 0; i < 1000000; ++i)
+            h->add(i + 500000);
+
+        return h;
+    });
+
+    r.add("HyperLogLog/estimate", [dense](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto e = dense->estimate();
+            doNotOptimize(e);
+        }
+    });
+
+    r.add("HyperLogLog/merge", [dense, other](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            dense->merge(*other);
+
+        clobberMemory();
+    });
+
+    auto cms = lazy([]() { return std::make_unique<Util::CountMinSketch>(0.0001, 0.001); });
+    r.add("CountMinSketch/add", [cms](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            cms->add(i & 0xffff);
+
+        clobberMemory();
+    });
+
+    r.add("CountMinSketch/estimate", [cms](uint64_t n)
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            sum += cms->estimate(i & 0xffff);
+
+        doNotOptimize(sum);
+    });
+}
+
+void registerShardSelection(Registry& r)
+{
+    const size_t kKeys = 1024;
+
+    auto hashes = std::make_shared<std::vector<uint64_t>>(kKeys);
+    for (size_t i = 0; i < kKeys; ++i)
+        (*hashes)[i] = Util::fmix64(i + 1);
+
+    const uint32_t shards[] = { 16, 1024 };
+    for (auto n : shards)
+    {
+        auto name = std::string("jumpConsistentHash/") + std::to_string(n);
+        r.add(name.c_str(), [hashes, n](uint64_t iterations)
+        {
+            uint32_t sum = 0;
+            for (uint64_t i = 0; i < iterations; ++i)
+                sum += Util::jumpConsistentHash((*hashes)[i % kKeys], n);
+
+            doNotOptimize(sum);
+        });
+    }
+
+    const uint32_t nodes[] = { 4, 16, 64 };
+    for (auto n : nodes)
+    {
+        auto uniform = std::make_shared<Util::RendezvousHash>();
+        auto weighted = std::make_shared<Util::RendezvousHash>();
+        for (uint32_t node = 0; node < n; ++node)
+        {
+            uniform->addNode(node);
+            weighted->addNode(node, 1.0 + node % 3);
+        }
+
+        auto name = std::string("RendezvousHash/") + std::to_string(n);
+        r.add(name.c_str(), [uniform, hashes](uint64_t iterations)
+        {
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < iterations; ++i)
+                sum += uniform->route((*hashes)[i % kKeys]);
+
+            doNotOptimize(sum);
+        });
+
+        r.add((name + " weighted").c_str(), [weighted, hashes](uint64_t iterations)
+        {
+            uint64_t sum = 0;
+            for (uint64_t i = 0; i < iterations; ++i)
+                sum += weighted->route((*hashes)[i % kKeys]);
+
+            doNotOptimize(sum);
+        });
+
+        r.add((name + " batch").c_str(), [uniform, hashes](uint64_t iterations)
+        {
+            uint64_t out[kKeys];
+            for (uint64_t i = 0; i < iterations; i += kKeys)
+            {
+                uniform->route(hashes->data(), kKeys, out);
+                doNotOptimize(out);
+            }
+        });
+    }
+}
+
+void registerRefCounted(Registry& r)
+{
+    r.add("RefCountedPtr/copy", [](uint64_t n)
+    {
+        Core::RefCountedPtr<Counted> p(new Counted);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            Core::RefCountedPtr<Counted> q(p);
+            doNotOptimize(q);
+        }
+    });
+
+    r.add("RefCountedPtr/move", [](uint64_t n)
+    {
+        Core::RefCountedPtr<Counted> p(new Counted);
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            Core::RefCountedPtr<Counted> q(std::move(p));
+            p = std::move(q);
+            doNotOptimize(p);
+        }
+    });
+}
+
+void registerFormat(Registry& r)
+{
+    r.add("Util::format/char", [](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto s = Util::format("%s %d %.3f", "value", int(i), 3.14);
+            doNotOptimize(s);
+        }
+    });
+
+    r.add("Util::format/wchar_t", [](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            auto s = Util::format(L"%s %d %.3f", L"value", int(i), 3.14);
+            doNotOptimize(s);
+        }
+    });
+}
+
+void registerTrace(Registry& r)
+{
+    r.add("Trace/writeDebug", [](uint64_t n)
+    {
+        for (uint64_t i = 0; i < n; ++i)
+            Core::Trace::writeDebug("Bench", __FILE__, __LINE__, L"record %d", int(i));
+    });
+
+    r.add("Trace/filtered", [](uint64_t n)
+    {
+        auto level = Core::Trace::g_Level;
+        Core::Trace::g_Level = Core::Trace::Off;
+        for (uint64_t i = 0; i < n; ++i)
+            Core::Trace::writeDebug("Bench", __FILE__, __LINE__, L"record %d", int(i));
+
+        Core::Trace::g_Level = level;
+    });
+}
+
+void registerPerfTimer(Registry& r)
+{
+    r.add("PerformanceTimer/disabled", [](uint64_t n)
+    {
+        PerformanceTimer::Disable();
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            PERFTIMER_SCOPE("Bench");
+            clobberMemory();
+        }
+
+        PerformanceTimer::Enable();
+    });
+
+    r.add("PerformanceTimer/enabled", [](uint64_t n)
+    {
+        PERFTIMER_SCOPE("Outer"); // keeps the report from being printed per iteration
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            PERFTIMER_SCOPE("Bench");
+            clobberMemory();
+        }
+    });
+}
+
+void usage()
+{
+    std::printf(
+        "Bench [--filter <substring>] [--json <out.json>] [--baseline <in.json>] [--threshold <ratio>] [--repetitions <n>]\n"
+        "Bench --quality\n"
+        );
+}
+
+} // namespace {}
+
+
+int main(int argc, char* argv[])
+{
+    const char* filter = nullptr;
+    const char* json = nullptr;
+    const char* baseline = nullptr;
+    double threshold = 0.05;
+    Options o;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        auto arg = argv[i];
+        auto hasValue = (i + 1 < argc);
+        if (!std::strcmp(arg, "--filter") && hasValue)
+            filter = argv[++i];
+        else if (!std::strcmp(arg, "--json") && hasValue)
+            json = argv[++i];
+        else if (!std::strcmp(arg, "--baseline") && hasValue)
+            baseline = argv[++i];
+        else if (!std::strcmp(arg, "--threshold") && hasValue)
+            threshold = std::atof(argv[++i]);
+        else if (!std::strcmp(arg, "--repetitions") && hasValue)
+            o.repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(arg, "--quality"))
+            return runMurmurQuality();
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    Core::CurrentThread::setName("Bench");
+    Core::Trace::initialize(false);
+
+    Registry r;
+    registerMurmur(r);
+    registerMurmurAlignment(r);
+    registerIntrusiveList(r);
+    registerQueues(r);
+    registerFreelists(r);
+    registerHashMaps(r);
+    registerIntrusiveHashTable(r);
+    registerLruCache(r);
+    registerOrderedIndex(r);
+    registerTimerWheel(r);
+    registerBloomFilter(r);
+    registerSketches(r);
+    registerShardSelection(r);
+    registerRefCounted(r);
+    registerFormat(r);
+    registerTrace(r);
+    registerPerfTimer(r);
+
+    auto results = r.run(filter, o);
+
+    Core::Trace::finaliize();
+
+    if (json && !saveJson(json, results))
+    {
+        std::printf("Failed to write %s\n", json);
+        return 2;
+    }
+
+    int regressions = 0;
+    if (baseline)
+    {
+        std::vector<Result> base;
+        if (!loadJson(baseline, base))
+        {
+            std::printf("Failed to read %s\n", baseline);
+            return 2;
+        }
+
+        std::printf("\n%-48s %12s %12s %8s\n", "vs. baseline", "base ns", "now ns", "change");
+        for (auto const& c : compare(base, results, threshold))
+        {
+            std::printf("%-48s %12.2f %12.2f %+7.1f%%%s\n", c.name.c_str(), c.baselineNs, c.currentNs, c.change * 100, c.regression ? "  REGRESSION" : "");
+            if (c.regression)
+                ++regressions;
+        }
+    }
+
+    return regressions ? 1 : 0;
+}